@@ -0,0 +1,33 @@
+divert(`-1')
+# bench-divert.m4 - benchmark corpus for run-bench: large diversions
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Spread N lines of about 1 KiB over nine diversions, enough for them
+# to spill to temporary files, then bring them all back.  Invoke as:
+# m4 -DN=count bench-divert.m4
+
+ifdef(`N', `', `define(`N', `50000')')
+include(`forloop2.m4')divert(`-1')
+define(`chunk', `0123456789abcdef')
+define(`chunk', chunk`'chunk`'chunk`'chunk)
+define(`chunk', chunk`'chunk`'chunk`'chunk)
+define(`chunk', chunk`'chunk`'chunk`'chunk)
+forloop(`i', `1', N, `divert(eval(i % 9 + 1))i chunk
+divert(`-1')')
+divert`'dnl
+undivert`'dnl
@@ -0,0 +1,32 @@
+divert(`-1')
+# bench-foreachq.m4 - benchmark corpus for run-bench: $@ recursion
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Walk a quoted list of N items with the quadratic $@ recursion of
+# foreachq, twice over.  Invoke as: m4 -DN=count bench-foreachq.m4
+
+ifdef(`N', `', `define(`N', `1500')')
+include(`forloop2.m4')divert(`-1')
+include(`foreachq2.m4')divert(`-1')
+define(`list', `item1')
+forloop(`i', `2', N, `define(`list', defn(`list')`,item'i)')
+divert`'dnl
+foreachq(`x', defn(`list'), `x
+')dnl
+foreachq(`x', defn(`list'), `len(`x')
+')dnl
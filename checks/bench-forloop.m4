@@ -0,0 +1,28 @@
+divert(`-1')
+# bench-forloop.m4 - benchmark corpus for run-bench: define/incr loops
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Run N iterations of forloop, each redefining a counter with incr and
+# emitting a short line.  Invoke as: m4 -DN=count bench-forloop.m4
+
+ifdef(`N', `', `define(`N', `100000')')
+include(`forloop2.m4')divert(`-1')
+define(`count', `0')
+divert`'dnl
+forloop(`i', `1', N, `define(`count', incr(count))count
+')dnl
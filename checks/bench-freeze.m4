@@ -0,0 +1,27 @@
+divert(`-1')
+# bench-freeze.m4 - benchmark corpus for run-bench: frozen file reload
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Define N macros, some of them stacked with pushdef, to be frozen with
+# -F; run-bench then times reloading the result with -R.  Invoke as:
+# m4 -DN=count -F file bench-freeze.m4
+
+ifdef(`N', `', `define(`N', `50000')')
+include(`forloop2.m4')divert(`-1')
+forloop(`i', `1', N, `define(`macro_'i, `expansion of macro number 'i)')
+forloop(`i', `1', eval(N / 10), `pushdef(`macro_'i, `stacked 'i)')
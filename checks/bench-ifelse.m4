@@ -0,0 +1,47 @@
+divert(`-1')
+# bench-ifelse.m4 - benchmark corpus for run-bench: ifelse chains
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Expand N times a chain of ifelse whose branches are a few kilobytes of
+# quoted text each, of which only one is taken, and a chain of ifelse
+# that dispatches on 200 fixed strings.
+# Invoke as: m4 -DN=count bench-ifelse.m4
+
+ifdef(`N', `', `define(`N', `100000')')
+define(`blob', `The quick brown fox jumps over the lazy dog; ')
+define(`blob', defn(`blob')defn(`blob'))
+define(`blob', defn(`blob')defn(`blob'))
+define(`blob', defn(`blob')defn(`blob'))
+define(`blob', defn(`blob')defn(`blob'))
+define(`blob', defn(`blob')defn(`blob'))
+define(`blob', defn(`blob')defn(`blob'))
+define(`mkpick', `define(`pick', `ifelse(`$'`1', `0', `zero $1',
+  `$'`1', `1', `one $1', `$'`1', `2', `two $1', `none')')')
+mkpick(defn(`blob'))
+changequote([,])
+define([cases], [])
+define([addcases], [ifelse([$1], [0], [],
+  [define([cases], [`$][1', `key$1', `value $1', ]defn([cases]))dnl
+addcases(decr([$1]))])])
+addcases([200])
+define([table], [ifelse(]defn([cases])[`none')])
+changequote(`,')
+define(`rep', `ifelse(`$1', `0', `', `pick(`3') table(`key150')
+rep(decr(`$1'))')')
+divert`'dnl
+rep(N)dnl
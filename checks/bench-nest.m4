@@ -0,0 +1,29 @@
+divert(`-1')
+# bench-nest.m4 - benchmark corpus for run-bench: nested calls
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Expand N times a call nested 50 deep, each level in the middle of an
+# argument of the level above.  Invoke as: m4 -DN=count bench-nest.m4
+
+ifdef(`N', `', `define(`N', `10000')')
+define(`f', `$1')
+define(`nest', `ifelse(`$1', `0', `x', `f(a nest(decr(`$1')))')')
+define(`rep', `ifelse(`$1', `0', `', `nest(`50')
+rep(decr(`$1'))')')
+divert`'dnl
+rep(N)dnl
@@ -0,0 +1,30 @@
+divert(`-1')
+# bench-tailcall.m4 - benchmark corpus for run-bench: tail recursion
+# Copyright (C) 2026 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Count to N with a macro that recurses as the last thing in its
+# expansion but one, leaving `' and dnl behind at each level; the peak
+# memory use should not depend on N.  Invoke as:
+# m4 -DN=count bench-tailcall.m4
+
+ifdef(`N', `', `define(`N', `500000')')
+define(`loop', `ifelse(`$1', N, `', `loop(incr(`$1'))')`'')
+define(`loopdnl', `ifelse(`$1', N, `', `$0(incr(`$1'))')dnl
+')
+divert`'dnl
+loop(`0')loopdnl(`0')done
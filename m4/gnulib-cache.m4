@@ -80,6 +80,7 @@
 #  maintainer-makefile \
 #  manywarnings \
 #  memchr2 \
+#  memmem \
 #  mkstemp \
 #  obstack \
 #  progname \
@@ -149,6 +150,7 @@ gl_MODULES([
   maintainer-makefile
   manywarnings
   memchr2
+  memmem
   mkstemp
   obstack
   progname
@@ -37,7 +37,9 @@
 
 /* Initialization of builtin and predefined macros.  The table
    "builtin_tab" is both used for initialization, and by the "builtin"
-   builtin.  */
+   builtin.  Builtins marked inert only ever expand to numbers, which
+   need not be rescanned unless the current syntax says otherwise (see
+   push_string_inert ()).  */
 
 #define DECLARE(name) \
   static void name (struct obstack *, int, token_data **)
@@ -63,15 +65,20 @@ DECLARE (m4_dumpdef);
 DECLARE (m4_errprint);
 DECLARE (m4_esyscmd);
 DECLARE (m4_eval);
+DECLARE (m4_forargs);
 DECLARE (m4_format);
+DECLARE (m4_forrange);
 DECLARE (m4_ifdef);
 DECLARE (m4_ifelse);
 DECLARE (m4_include);
 DECLARE (m4_incr);
 DECLARE (m4_index);
 DECLARE (m4_indir);
+DECLARE (m4_joinargs);
 DECLARE (m4_len);
+DECLARE (m4_lowercase);
 DECLARE (m4_m4exit);
+DECLARE (m4_m4stats);
 DECLARE (m4_m4wrap);
 DECLARE (m4_maketemp);
 DECLARE (m4_mkstemp);
@@ -79,8 +86,10 @@ DECLARE (m4_patsubst);
 DECLARE (m4_popdef);
 DECLARE (m4_pushdef);
 DECLARE (m4_regexp);
+DECLARE (m4_repeat);
 DECLARE (m4_shift);
 DECLARE (m4_sinclude);
+DECLARE (m4_splitargs);
 DECLARE (m4_substr);
 DECLARE (m4_syscmd);
 DECLARE (m4_sysval);
@@ -89,68 +98,77 @@ DECLARE (m4_traceon);
 DECLARE (m4_translit);
 DECLARE (m4_undefine);
 DECLARE (m4_undivert);
+DECLARE (m4_uppercase);
 
 #undef DECLARE
 
 static builtin const builtin_tab[] =
 {
 
-  /* name               GNUext  macros  blind   function */
+  /* name               GNUext  macros  blind   inert   function */
 
-  { "__file__",         true,   false,  false,  m4___file__ },
-  { "__line__",         true,   false,  false,  m4___line__ },
-  { "__program__",      true,   false,  false,  m4___program__ },
-  { "builtin",          true,   true,   true,   m4_builtin },
-  { "changecom",        false,  false,  false,  m4_changecom },
-  { "changequote",      false,  false,  false,  m4_changequote },
+  { "__file__",         true,   false,  false,  false,  m4___file__ },
+  { "__line__",         true,   false,  false,  true,   m4___line__ },
+  { "__program__",      true,   false,  false,  false,  m4___program__ },
+  { "builtin",          true,   true,   true,   false,  m4_builtin },
+  { "changecom",        false,  false,  false,  false,  m4_changecom },
+  { "changequote",      false,  false,  false,  false,  m4_changequote },
 #ifdef ENABLE_CHANGEWORD
-  { "changeword",       true,   false,  true,   m4_changeword },
+  { "changeword",       true,   false,  true,   false,  m4_changeword },
 #endif
-  { "debugmode",        true,   false,  false,  m4_debugmode },
-  { "debugfile",        true,   false,  false,  m4_debugfile },
-  { "decr",             false,  false,  true,   m4_decr },
-  { "define",           false,  true,   true,   m4_define },
-  { "defn",             false,  false,  true,   m4_defn },
-  { "divert",           false,  false,  false,  m4_divert },
-  { "divnum",           false,  false,  false,  m4_divnum },
-  { "dnl",              false,  false,  false,  m4_dnl },
-  { "dumpdef",          false,  false,  false,  m4_dumpdef },
-  { "errprint",         false,  false,  true,   m4_errprint },
-  { "esyscmd",          true,   false,  true,   m4_esyscmd },
-  { "eval",             false,  false,  true,   m4_eval },
-  { "format",           true,   false,  true,   m4_format },
-  { "ifdef",            false,  false,  true,   m4_ifdef },
-  { "ifelse",           false,  false,  true,   m4_ifelse },
-  { "include",          false,  false,  true,   m4_include },
-  { "incr",             false,  false,  true,   m4_incr },
-  { "index",            false,  false,  true,   m4_index },
-  { "indir",            true,   true,   true,   m4_indir },
-  { "len",              false,  false,  true,   m4_len },
-  { "m4exit",           false,  false,  false,  m4_m4exit },
-  { "m4wrap",           false,  false,  true,   m4_m4wrap },
-  { "maketemp",         false,  false,  true,   m4_maketemp },
-  { "mkstemp",          false,  false,  true,   m4_mkstemp },
-  { "patsubst",         true,   false,  true,   m4_patsubst },
-  { "popdef",           false,  false,  true,   m4_popdef },
-  { "pushdef",          false,  true,   true,   m4_pushdef },
-  { "regexp",           true,   false,  true,   m4_regexp },
-  { "shift",            false,  false,  true,   m4_shift },
-  { "sinclude",         false,  false,  true,   m4_sinclude },
-  { "substr",           false,  false,  true,   m4_substr },
-  { "syscmd",           false,  false,  true,   m4_syscmd },
-  { "sysval",           false,  false,  false,  m4_sysval },
-  { "traceoff",         false,  false,  false,  m4_traceoff },
-  { "traceon",          false,  false,  false,  m4_traceon },
-  { "translit",         false,  false,  true,   m4_translit },
-  { "undefine",         false,  false,  true,   m4_undefine },
-  { "undivert",         false,  false,  false,  m4_undivert },
-
-  { 0,                  false,  false,  false,  0 },
+  { "debugmode",        true,   false,  false,  false,  m4_debugmode },
+  { "debugfile",        true,   false,  false,  false,  m4_debugfile },
+  { "decr",             false,  false,  true,   true,   m4_decr },
+  { "define",           false,  true,   true,   false,  m4_define },
+  { "defn",             false,  false,  true,   false,  m4_defn },
+  { "divert",           false,  false,  false,  false,  m4_divert },
+  { "divnum",           false,  false,  false,  true,   m4_divnum },
+  { "dnl",              false,  false,  false,  false,  m4_dnl },
+  { "dumpdef",          false,  false,  false,  false,  m4_dumpdef },
+  { "errprint",         false,  false,  true,   false,  m4_errprint },
+  { "esyscmd",          true,   false,  true,   false,  m4_esyscmd },
+  { "eval",             false,  false,  true,   true,   m4_eval },
+  { "forargs",          true,   false,  true,   false,  m4_forargs },
+  { "format",           true,   false,  true,   false,  m4_format },
+  { "forrange",         true,   false,  true,   false,  m4_forrange },
+  { "ifdef",            false,  false,  true,   false,  m4_ifdef },
+  { "ifelse",           false,  false,  true,   false,  m4_ifelse },
+  { "include",          false,  false,  true,   false,  m4_include },
+  { "incr",             false,  false,  true,   true,   m4_incr },
+  { "index",            false,  false,  true,   true,   m4_index },
+  { "indir",            true,   true,   true,   false,  m4_indir },
+  { "joinargs",         true,   false,  true,   false,  m4_joinargs },
+  { "len",              false,  false,  true,   true,   m4_len },
+  { "lowercase",        true,   false,  true,   false,  m4_lowercase },
+  { "m4exit",           false,  false,  false,  false,  m4_m4exit },
+  { "m4stats",          true,   false,  false,  true,   m4_m4stats },
+  { "m4wrap",           false,  false,  true,   false,  m4_m4wrap },
+  { "maketemp",         false,  false,  true,   false,  m4_maketemp },
+  { "mkstemp",          false,  false,  true,   false,  m4_mkstemp },
+  { "patsubst",         true,   false,  true,   false,  m4_patsubst },
+  { "popdef",           false,  false,  true,   false,  m4_popdef },
+  { "pushdef",          false,  true,   true,   false,  m4_pushdef },
+  { "regexp",           true,   false,  true,   false,  m4_regexp },
+  { "repeat",           true,   false,  true,   false,  m4_repeat },
+  { "shift",            false,  false,  true,   false,  m4_shift },
+  { "sinclude",         false,  false,  true,   false,  m4_sinclude },
+  { "splitargs",        true,   false,  true,   false,  m4_splitargs },
+  { "substr",           false,  false,  true,   false,  m4_substr },
+  { "syscmd",           false,  false,  true,   false,  m4_syscmd },
+  { "sysval",           false,  false,  false,  true,   m4_sysval },
+  { "traceoff",         false,  false,  false,  false,  m4_traceoff },
+  { "traceon",          false,  false,  false,  false,  m4_traceon },
+  { "translit",         false,  false,  true,   false,  m4_translit },
+  { "undefine",         false,  false,  true,   false,  m4_undefine },
+  { "undivert",         false,  false,  false,  false,  m4_undivert },
+  { "uppercase",        true,   false,  true,   false,  m4_uppercase },
+
+  { 0,                  false,  false,  false,  false,  0 },
 
   /* placeholder is intentionally stuck after the table end delimiter,
      so that we can easily find it, while not treating it as a real
      builtin.  */
-  { "placeholder",      true,   false,  false,  m4_placeholder },
+  { "placeholder",      true,   false,  false,  false,  m4_placeholder },
 };
 
 static predefined const predefined_tab[] =
@@ -213,13 +231,23 @@ find_builtin_by_name (const char *name)
 void
 define_builtin (const char *name, const builtin *bp, symbol_lookup mode)
 {
-  symbol *sym;
+  set_builtin_definition (lookup_symbol (name, mode), bp);
+}
+
+/*------------------------------------------------------.
+| Bind the symbol SYM to the C function given in BP.    |
+`------------------------------------------------------*/
 
-  sym = lookup_symbol (name, mode);
+void
+set_builtin_definition (symbol *sym, const builtin *bp)
+{
   SYMBOL_TYPE (sym) = TOKEN_FUNC;
   SYMBOL_MACRO_ARGS (sym) = bp->groks_macro_args;
   SYMBOL_BLIND_NO_ARGS (sym) = bp->blind_if_no_args;
+  SYMBOL_INERT (sym) = bp->inert;
   SYMBOL_FUNC (sym) = bp->func;
+  free (SYMBOL_DISPATCH (sym));
+  SYMBOL_DISPATCH (sym) = NULL;
 }
 
 /* Storage for the compiled regular expression of
@@ -281,6 +309,56 @@ free_macro_sequence (void)
   free_pattern_buffer (&macro_sequence_buf, &macro_sequence_regs);
 }
 
+/*--------------------------------------------------------------.
+| Implement --warn-macro-sequence, by warning about any match   |
+| within DEFN, the new definition of macro NAME.                |
+`--------------------------------------------------------------*/
+
+static void
+check_macro_sequence (const char *name, char *defn)
+{
+  regoff_t offset = 0;
+  size_t len = strlen (defn);
+
+  while ((offset = re_search (&macro_sequence_buf, defn, len, offset,
+                              len - offset, &macro_sequence_regs)) >= 0)
+    {
+      /* Skip empty matches.  */
+      if (macro_sequence_regs.start[0] == macro_sequence_regs.end[0])
+        offset++;
+      else
+        {
+          char tmp;
+          offset = macro_sequence_regs.end[0];
+          tmp = defn[offset];
+          defn[offset] = '\0';
+          M4ERROR ((warning_status, 0,
+                    _("Warning: definition of `%s' contains sequence `%s'"),
+                    name, defn + macro_sequence_regs.start[0]));
+          defn[offset] = tmp;
+        }
+    }
+  if (offset == -2)
+    M4ERROR ((warning_status, 0,
+              _("error checking --warn-macro-sequence for macro `%s'"),
+              name));
+}
+
+/*-----------------------------------------------------------------.
+| Return true if TEXT, the definition of a user macro, can neither |
+| refer to arguments nor contain a macro name, so that whether its |
+| expansion has to be rescanned depends only on the syntax.        |
+`-----------------------------------------------------------------*/
+
+static bool ATTRIBUTE_PURE
+inert_definition (const char *text)
+{
+  for (; *text; text++)
+    if (*text == '$' || *text == '_' || c_isalpha (*text))
+      return false;
+  return true;
+}
+
 /*-----------------------------------------------------------------.
 | Define a predefined or user-defined macro, with name NAME, and   |
 | expansion TEXT.  MODE destinguishes between the "define" and the |
@@ -294,41 +372,53 @@ define_user_macro (const char *name, const char *text, symbol_lookup mode)
   char *defn = xstrdup (text ? text : "");
 
   s = lookup_symbol (name, mode);
-  if (SYMBOL_TYPE (s) == TOKEN_TEXT)
+  if (SYMBOL_TYPE (s) == TOKEN_TEXT && !SYMBOL_MAPPED (s))
     free (SYMBOL_TEXT (s));
 
   SYMBOL_TYPE (s) = TOKEN_TEXT;
   SYMBOL_TEXT (s) = defn;
+  SYMBOL_MAPPED (s) = false;
+  SYMBOL_INERT (s) = inert_definition (defn);
+  free (SYMBOL_DISPATCH (s));
+  SYMBOL_DISPATCH (s) = NULL;
 
   /* Implement --warn-macro-sequence.  */
   if (macro_sequence_inuse && text)
-    {
-      regoff_t offset = 0;
-      size_t len = strlen (defn);
+    check_macro_sequence (name, defn);
+}
 
-      while ((offset = re_search (&macro_sequence_buf, defn, len, offset,
-                                  len - offset, &macro_sequence_regs)) >= 0)
-        {
-          /* Skip empty matches.  */
-          if (macro_sequence_regs.start[0] == macro_sequence_regs.end[0])
-            offset++;
-          else
-            {
-              char tmp;
-              offset = macro_sequence_regs.end[0];
-              tmp = defn[offset];
-              defn[offset] = '\0';
-              M4ERROR ((warning_status, 0,
-                        _("Warning: definition of `%s' contains sequence `%s'"),
-                        name, defn + macro_sequence_regs.start[0]));
-              defn[offset] = tmp;
-            }
-        }
-      if (offset == -2)
-        M4ERROR ((warning_status, 0,
-                  _("error checking --warn-macro-sequence for macro `%s'"),
-                  name));
-    }
+/*-------------------------------------------------------------------.
+| Like define_user_macro, but TEXT belongs to a reloaded frozen file |
+| that stays in memory until exit, so it is used in place instead of |
+| being copied, and is never freed.                                  |
+`-------------------------------------------------------------------*/
+
+void
+define_mapped_macro (const char *name, char *text, symbol_lookup mode)
+{
+  set_mapped_definition (lookup_symbol (name, mode), text);
+}
+
+/*----------------------------------------------------------------.
+| Make TEXT, which belongs to a reloaded frozen file as described |
+| for define_mapped_macro, the expansion of the symbol SYM.       |
+`----------------------------------------------------------------*/
+
+void
+set_mapped_definition (symbol *sym, char *text)
+{
+  if (SYMBOL_TYPE (sym) == TOKEN_TEXT && !SYMBOL_MAPPED (sym))
+    free (SYMBOL_TEXT (sym));
+
+  SYMBOL_TYPE (sym) = TOKEN_TEXT;
+  SYMBOL_TEXT (sym) = text;
+  SYMBOL_MAPPED (sym) = true;
+  SYMBOL_INERT (sym) = inert_definition (text);
+  free (SYMBOL_DISPATCH (sym));
+  SYMBOL_DISPATCH (sym) = NULL;
+
+  if (macro_sequence_inuse)
+    check_macro_sequence (SYMBOL_NAME (sym), text);
 }
 
 /*-----------------------------------------------.
@@ -513,8 +603,7 @@ dump_args (struct obstack *obs, int argc, token_data **argv,
         obstack_grow (obs, sep, len);
       if (quoted)
         obstack_grow (obs, lquote.string, lquote.length);
-      obstack_grow (obs, TOKEN_DATA_TEXT (argv[i]),
-                    strlen (TOKEN_DATA_TEXT (argv[i])));
+      obstack_grow (obs, TOKEN_DATA_TEXT (argv[i]), TOKEN_DATA_LEN (argv[i]));
       if (quoted)
         obstack_grow (obs, rquote.string, rquote.length);
     }
@@ -643,7 +732,7 @@ m4_ifdef (struct obstack *obs, int argc, token_data **argv)
 static void
 m4_ifelse (struct obstack *obs, int argc, token_data **argv)
 {
-  const char *result;
+  token_data *result;
   token_data *me = argv[0];
 
   if (argc == 2)
@@ -661,8 +750,9 @@ m4_ifelse (struct obstack *obs, int argc, token_data **argv)
   result = NULL;
   while (result == NULL)
 
-    if (STREQ (ARG (0), ARG (1)))
-      result = ARG (2);
+    if (TOKEN_DATA_LEN (argv[0]) == TOKEN_DATA_LEN (argv[1])
+        && memcmp (ARG (0), ARG (1), TOKEN_DATA_LEN (argv[0])) == 0)
+      result = argv[2];
 
     else
       switch (argc)
@@ -672,7 +762,7 @@ m4_ifelse (struct obstack *obs, int argc, token_data **argv)
 
         case 4:
         case 5:
-          result = ARG (3);
+          result = argv[3];
           break;
 
         default:
@@ -680,7 +770,184 @@ m4_ifelse (struct obstack *obs, int argc, token_data **argv)
           argv += 3;
         }
 
-  obstack_grow (obs, result, strlen (result));
+  obstack_grow (obs, TOKEN_DATA_TEXT (result), TOKEN_DATA_LEN (result));
+}
+
+/*------------------------------------------------------------------.
+| Loops of m4.  The text of a loop is expanded to once, and pushed  |
+| as a loop of input that is read as many times as there are        |
+| values (see push_string_loop () in input.c).  The iterator is     |
+| pushed with the first value, redefined to the next one by         |
+| loop_step () between passes, and when the loop is done, given     |
+| back the definition it had before the loop, whatever the text of  |
+| the loop pushed or popped meanwhile.                              |
+`------------------------------------------------------------------*/
+
+struct loop_data
+{
+  char *name;                   /* name of the iterator */
+  int next;                     /* last value, for "forrange" */
+  char *values;                 /* else the values, NUL separated */
+  const char *value;            /* last value in values */
+  size_t depth;                 /* definitions of name before the loop */
+  char *prior_text;             /* the topmost one, if a user macro */
+  const builtin *prior_builtin; /* or if a builtin */
+};
+
+typedef struct loop_data loop_data;
+
+/* Return the number of definitions stacked for the macro NAME.  */
+static size_t
+definition_depth (const char *name)
+{
+  symbol *s = lookup_symbol (name, SYMBOL_LOOKUP);
+  size_t depth = 0;
+
+  for (; s != NULL && SYMBOL_TYPE (s) != TOKEN_VOID; s = SYMBOL_STACK (s))
+    depth++;
+  return depth;
+}
+
+/*-----------------------------------------------------------------.
+| Give the iterator of LOOP back the definitions it had before the |
+| loop: pop any pushed since, and restore the topmost one unless   |
+| it is still in place.  Definitions below the topmost one, if the |
+| text of the loop popped them, are not restored.                  |
+`-----------------------------------------------------------------*/
+
+static void
+end_loop (loop_data *loop)
+{
+  size_t depth = definition_depth (loop->name);
+  symbol *s;
+
+  for (; depth > loop->depth; depth--)
+    lookup_symbol (loop->name, SYMBOL_POPDEF);
+  if (!loop->prior_text && !loop->prior_builtin)
+    return;
+
+  s = lookup_symbol (loop->name, SYMBOL_LOOKUP);
+  if (depth == loop->depth
+      && (loop->prior_text
+          ? (SYMBOL_TYPE (s) == TOKEN_TEXT
+             && STREQ (SYMBOL_TEXT (s), loop->prior_text))
+          : (SYMBOL_TYPE (s) == TOKEN_FUNC
+             && SYMBOL_FUNC (s) == loop->prior_builtin->func)))
+    return;
+  if (loop->prior_text)
+    define_user_macro (loop->name, loop->prior_text,
+                       depth < loop->depth ? SYMBOL_PUSHDEF : SYMBOL_INSERT);
+  else
+    define_builtin (loop->name, loop->prior_builtin,
+                    depth < loop->depth ? SYMBOL_PUSHDEF : SYMBOL_INSERT);
+}
+
+static void
+loop_step (void *arg, bool done)
+{
+  loop_data *loop = (loop_data *) arg;
+
+  if (done)
+    {
+      end_loop (loop);
+      free (loop->name);
+      free (loop->values);
+      free (loop->prior_text);
+      free (loop);
+    }
+  else if (loop->values)
+    {
+      loop->value += strlen (loop->value) + 1;
+      define_user_macro (loop->name, loop->value, SYMBOL_INSERT);
+    }
+  else
+    define_user_macro (loop->name, ntoa ((int32_t) ++loop->next, 10),
+                       SYMBOL_INSERT);
+}
+
+/*-----------------------------------------------------------------.
+| Start a loop over COUNT values with the text BODY, the iterator  |
+| named NAME being pushed with FIRST.  LOOP holds the values after |
+| the first, and is released when the loop is done.                |
+`-----------------------------------------------------------------*/
+
+static void
+start_loop (struct obstack *obs, loop_data *loop, const char *name,
+            const char *first, size_t count, token_data *body)
+{
+  symbol *s;
+
+  loop->name = xstrdup (name);
+  loop->depth = definition_depth (name);
+  if (loop->depth)
+    {
+      s = lookup_symbol (name, SYMBOL_LOOKUP);
+      if (SYMBOL_TYPE (s) == TOKEN_TEXT)
+        loop->prior_text = xstrdup (SYMBOL_TEXT (s));
+      else
+        loop->prior_builtin = find_builtin_by_addr (SYMBOL_FUNC (s));
+    }
+  define_user_macro (name, first, SYMBOL_PUSHDEF);
+  obstack_grow (obs, TOKEN_DATA_TEXT (body), TOKEN_DATA_LEN (body));
+  push_string_loop (count, loop_step, loop);
+}
+
+/*-------------------------------------------------------------------.
+| The macro "forrange" expands the fourth argument once for each     |
+| integer from the second argument to the third, inclusive, with the |
+| macro named by the first argument defined to that integer.         |
+`-------------------------------------------------------------------*/
+
+static void
+m4_forrange (struct obstack *obs, int argc, token_data **argv)
+{
+  int start;
+  int end;
+  loop_data *loop;
+
+  if (bad_argc (argv[0], argc, 5, 5))
+    return;
+  if (!numeric_arg (argv[0], ARG (2), &start)
+      || !numeric_arg (argv[0], ARG (3), &end))
+    return;
+  if (start > end)
+    return;
+
+  loop = (loop_data *) xzalloc (sizeof *loop);
+  loop->next = start;
+  start_loop (obs, loop, ARG (1), ntoa ((int32_t) start, 10),
+              (size_t) ((intmax_t) end - start + 1), argv[4]);
+}
+
+/*------------------------------------------------------------------.
+| The macro "forargs" expands the second argument once for each     |
+| argument after it, with the macro named by the first argument     |
+| defined to that argument.                                         |
+`------------------------------------------------------------------*/
+
+static void
+m4_forargs (struct obstack *obs, int argc, token_data **argv)
+{
+  loop_data *loop;
+  size_t size = 0;
+  char *p;
+  int i;
+
+  if (bad_argc (argv[0], argc, 3, -1) || argc == 3)
+    return;
+
+  for (i = 3; i < argc; i++)
+    size += strlen (ARG (i)) + 1;
+  loop = (loop_data *) xzalloc (sizeof *loop);
+  loop->values = p = xcharalloc (size);
+  for (i = 3; i < argc; i++)
+    {
+      size_t len = strlen (ARG (i)) + 1;
+      memcpy (p, ARG (i), len);
+      p += len;
+    }
+  loop->value = loop->values;
+  start_loop (obs, loop, ARG (1), loop->value, argc - 3, argv[2]);
 }
 
 /*-------------------------------------------------------------------.
@@ -832,6 +1099,7 @@ m4_builtin (struct obstack *obs, int argc, token_data **argv)
             {
               TOKEN_DATA_TYPE (argv[i]) = TOKEN_TEXT;
               TOKEN_DATA_TEXT (argv[i]) = (char *) "";
+              TOKEN_DATA_LEN (argv[i]) = 0;
             }
       bp->func (obs, argc - 1, argv + 1);
     }
@@ -873,6 +1141,7 @@ m4_indir (struct obstack *obs, int argc, token_data **argv)
             {
               TOKEN_DATA_TYPE (argv[i]) = TOKEN_TEXT;
               TOKEN_DATA_TEXT (argv[i]) = (char *) "";
+              TOKEN_DATA_LEN (argv[i]) = 0;
             }
       call_macro (s, argc - 1, argv + 1, obs);
     }
@@ -982,6 +1251,8 @@ m4_syscmd (struct obstack *obs MAYBE_UNUSED, int argc, token_data **argv)
         M4ERROR ((warning_status, errno, _("cannot run command `%s'"), cmd));
       sysval = status;
     }
+  /* The command may have created files that include should find.  */
+  forget_include_paths ();
 }
 
 static void
@@ -1069,6 +1340,7 @@ m4_esyscmd (struct obstack *obs, int argc, token_data **argv)
         M4ERROR ((warning_status, errno, _("cannot run command `%s'"), cmd));
       sysval = status;
     }
+  forget_include_paths ();
 }
 
 static void
@@ -1358,13 +1630,20 @@ m4_changeword (struct obstack *obs MAYBE_UNUSED, int argc, token_data **argv)
 static void
 include (int argc, token_data **argv, bool silent)
 {
+  cached_file *cached;
   FILE *fp;
   char *name;
 
   if (bad_argc (argv[0], argc, 2, 2))
     return;
 
-  fp = m4_path_search (ARG (1), &name);
+  cached = include_search (ARG (1), &name, &fp);
+  if (cached)
+    {
+      push_cached_file (cached, name);
+      free (name);
+      return;
+    }
   if (fp == NULL)
     {
       if (!silent)
@@ -1438,6 +1717,7 @@ mkstemp_helper (struct obstack *obs, const char *me, const char *pattern,
   else
     {
       close (fd);
+      forget_include_paths ();
       /* Remove NUL, then finish quote.  */
       obstack_blank_fast (obs, -1);
       obstack_grow (obs, rquote.string, rquote.length);
@@ -1727,10 +2007,41 @@ m4_debugfile (struct obstack *obs MAYBE_UNUSED, int argc, token_data **argv)
     M4ERROR ((warning_status, errno,
               _("cannot set debug file `%s'"), ARG (1)));
 }
+
+/*-----------------------------------------------------------------.
+| Report the internal statistics.  With one argument, expand to    |
+| the value of the statistic it names; with none, print them all   |
+| on the debug stream.                                             |
+`-----------------------------------------------------------------*/
+
+static void
+m4_m4stats (struct obstack *obs, int argc, token_data **argv)
+{
+  char buf[INT_BUFSIZE_BOUND (uintmax_t)];
+  uintmax_t value;
+
+  if (bad_argc (argv[0], argc, 1, 2))
+    return;
+
+  if (argc == 1)
+    {
+      if (debug != NULL)
+        stats_report (debug);
+    }
+  else if (stats_value (ARG (1), &value))
+    {
+      sprintf (buf, "%ju", value);
+      obstack_grow (obs, buf, strlen (buf));
+    }
+  else
+    M4ERROR ((warning_status, 0,
+              _("%s: unknown statistic `%s'"), ARG (0), ARG (1)));
+}
 
 /* This section contains text processing macros: "len", "index",
-   "substr", "translit", "format", "regexp" and "patsubst".  The last
-   three are GNU specific.  */
+   "substr", "translit", "joinargs", "splitargs", "repeat",
+   "uppercase", "lowercase", "format", "regexp" and "patsubst".  All
+   but the first four are GNU specific.  */
 
 /*---------------------------------------------.
 | Expand to the length of the first argument.  |
@@ -1741,22 +2052,47 @@ m4_len (struct obstack *obs, int argc, token_data **argv)
 {
   if (bad_argc (argv[0], argc, 2, 2))
     return;
-  shipout_int (obs, strlen (ARG (1)));
+  shipout_int (obs, TOKEN_DATA_LEN (argv[1]));
+}
+
+/*------------------------------------------------------------------.
+| Return the first occurrence of the NEEDLE_LEN bytes at NEEDLE in  |
+| the HAYSTACK_LEN bytes at HAYSTACK, or NULL if there is none.  A  |
+| single byte is looked for with memchr; longer needles with        |
+| memmem, which runs in linear time whatever the needle.            |
+`------------------------------------------------------------------*/
+
+static const char *
+find_substring (const char *haystack, size_t haystack_len,
+                const char *needle, size_t needle_len)
+{
+  if (needle_len == 0)
+    return haystack;
+  if (needle_len > haystack_len)
+    return NULL;
+  if (needle_len == 1)
+    return (const char *) memchr (haystack, *needle, haystack_len);
+  return (const char *) memmem (haystack, haystack_len, needle, needle_len);
 }
 
 /*-------------------------------------------------------------------.
 | The macro expands to the first index of the second argument in the |
-| first argument.                                                    |
+| first argument, at or after the index given by the optional third  |
+| argument, which counts from the end of the first argument if it is |
+| negative.                                                          |
 `-------------------------------------------------------------------*/
 
 static void
 m4_index (struct obstack *obs, int argc, token_data **argv)
 {
   const char *haystack;
+  size_t len;
   const char *result;
+  intmax_t offset = 0;
+  int start;
   int retval;
 
-  if (bad_argc (argv[0], argc, 3, 3))
+  if (bad_argc (argv[0], argc, 3, no_gnu_extensions ? 3 : 4))
     {
       /* builtin(`index') is blank, but index(`abc') is 0.  */
       if (argc == 2)
@@ -1765,7 +2101,23 @@ m4_index (struct obstack *obs, int argc, token_data **argv)
     }
 
   haystack = ARG (1);
-  result = strstr (haystack, ARG (2));
+  len = TOKEN_DATA_LEN (argv[1]);
+  if (argc >= 4 && !no_gnu_extensions)
+    {
+      if (!numeric_arg (argv[0], ARG (3), &start))
+        return;
+      offset = start;
+      if (offset < 0)
+        offset = offset + (intmax_t) len < 0 ? 0 : offset + (intmax_t) len;
+      if ((uintmax_t) offset > len)
+        {
+          shipout_int (obs, -1);
+          return;
+        }
+    }
+
+  result = find_substring (haystack + offset, len - offset,
+                           ARG (2), TOKEN_DATA_LEN (argv[2]));
   retval = result ? result - haystack : -1;
 
   shipout_int (obs, retval);
@@ -1854,6 +2206,118 @@ expand_ranges (const char *s, struct obstack *obs)
   return (char *) obstack_finish (obs);
 }
 
+/* A translation table of translit, for one pair of second and third
+   arguments, which are kept as given, before expanding ranges.  */
+struct translit_table
+{
+  char *from;                           /* second argument */
+  size_t from_len;
+  char *to;                             /* third argument */
+  size_t to_len;
+  unsigned char map[UCHAR_MAX + 1];     /* translation of each byte */
+  unsigned char keep[UCHAR_MAX + 1];    /* 0 if the byte is deleted */
+  bool deletes;                         /* true if any byte is deleted */
+};
+
+typedef struct translit_table translit_table;
+
+/* Macros that convert case call translit with the same arguments over
+   and over, so the last few tables are kept, and replaced in turn.  */
+#define TRANSLIT_CACHE_SIZE 16
+
+static translit_table *translit_cache[TRANSLIT_CACHE_SIZE];
+static int translit_next;               /* next entry to replace */
+
+/*------------------------------------------------------------------.
+| Return the translation table of translit for the second argument  |
+| FROM, of length FROM_LEN, and the third argument TO, of length    |
+| TO_LEN, from the cache, or built and cached.  OBS is used for the |
+| expansion of ranges, and left as it was.                          |
+`------------------------------------------------------------------*/
+
+static const translit_table *
+translit_lookup (const char *from, size_t from_len,
+                 const char *to, size_t to_len, struct obstack *obs)
+{
+  translit_table *t;
+  const char *base = NULL;
+  unsigned char ch;
+  int i;
+
+  for (i = 0; i < TRANSLIT_CACHE_SIZE; i++)
+    {
+      t = translit_cache[i];
+      if (t && t->from_len == from_len && t->to_len == to_len
+          && memcmp (t->from, from, from_len) == 0
+          && memcmp (t->to, to, to_len) == 0)
+        return t;
+    }
+
+  t = translit_cache[translit_next];
+  if (t)
+    {
+      free (t->from);
+      free (t->to);
+    }
+  else
+    t = translit_cache[translit_next] = XMALLOC (translit_table);
+  translit_next = (translit_next + 1) % TRANSLIT_CACHE_SIZE;
+  t->from = xmemdup (from, from_len + 1);
+  t->from_len = from_len;
+  t->to = xmemdup (to, to_len + 1);
+  t->to_len = to_len;
+
+  if (strchr (to, '-') != NULL)
+    {
+      base = to = expand_ranges (to, obs);
+      assert (to && *to);
+    }
+  if (strchr (from, '-') != NULL)
+    {
+      from = expand_ranges (from, obs);
+      assert (from && *from);
+      if (!base)
+        base = from;
+    }
+
+  /* Calling strchr(from) for each character in data is quadratic,
+     since both strings can be arbitrarily long.  Instead, create a
+     from-to mapping in one pass of from, then use that map in one
+     pass of data, for linear behavior.  Traditional behavior is that
+     only the first instance of a character in from is consulted,
+     hence bytes already seen are skipped.  */
+  for (i = 0; i <= UCHAR_MAX; i++)
+    {
+      t->map[i] = i;
+      t->keep[i] = 1;
+    }
+  t->deletes = false;
+  {
+    bool found[UCHAR_MAX + 1];
+
+    memset (found, 0, sizeof found);
+    for ( ; (ch = *from) != '\0'; from++)
+      {
+        if (! found[ch])
+          {
+            found[ch] = true;
+            t->map[ch] = *to;
+            if (*to == '\0')
+              {
+                t->keep[ch] = 0;
+                t->deletes = true;
+              }
+          }
+        if (*to != '\0')
+          to++;
+      }
+  }
+
+  if (base)
+    obstack_free (obs, (void *) base);
+  return t;
+}
+
 /*-----------------------------------------------------------------.
 | The macro "translit" translates all characters in the first      |
 | argument, which are present in the second argument, into the     |
@@ -1868,9 +2332,10 @@ m4_translit (struct obstack *obs, int argc, token_data **argv)
   const char *data = ARG (1);
   const char *from = ARG (2);
   const char *to;
-  char map[UCHAR_MAX + 1];
-  char found[UCHAR_MAX + 1];
-  unsigned char ch;
+  const translit_table *t;
+  size_t len;
+  size_t i;
+  char *out;
 
   if (bad_argc (argv[0], argc, 3, 4) || !*data || !*from)
     {
@@ -1881,11 +2346,7 @@ m4_translit (struct obstack *obs, int argc, token_data **argv)
     }
 
   to = ARG (3);
-  if (strchr (to, '-') != NULL)
-    {
-      to = expand_ranges (to, obs);
-      assert (to && *to);
-    }
+  len = TOKEN_DATA_LEN (argv[1]);
 
   /* If there are only one or two bytes to replace, it is faster to
      use memchr2.  Using expand_ranges does nothing unless there are
@@ -1893,7 +2354,12 @@ m4_translit (struct obstack *obs, int argc, token_data **argv)
   if (!from[1] || !from[2])
     {
       const char *p;
-      size_t len = strlen (data);
+
+      if (strchr (to, '-') != NULL)
+        {
+          to = expand_ranges (to, obs);
+          assert (to && *to);
+        }
       while ((p = (char *) memchr2 (data, from[0], from[1], len)))
         {
           obstack_grow (obs, data, p - data);
@@ -1911,40 +2377,184 @@ m4_translit (struct obstack *obs, int argc, token_data **argv)
       return;
     }
 
-  if (strchr (from, '-') != NULL)
+  t = translit_lookup (from, TOKEN_DATA_LEN (argv[2]), to,
+                       argc > 3 ? TOKEN_DATA_LEN (argv[3]) : 0, obs);
+
+  /* Translate into room reserved for the whole of data, and give back
+     the room of the bytes deleted.  */
+  obstack_blank (obs, len);
+  out = (char *) obstack_next_free (obs) - len;
+  if (!t->deletes)
+    for (i = 0; i < len; i++)
+      out[i] = t->map[to_uchar (data[i])];
+  else
     {
-      from = expand_ranges (from, obs);
-      assert (from && *from);
+      for (i = 0; i < len; i++)
+        {
+          unsigned char ch = data[i];
+          *out = t->map[ch];
+          out += t->keep[ch];
+        }
+      obstack_blank_fast (obs, out - (char *) obstack_next_free (obs));
     }
+}
 
-  /* Calling strchr(from) for each character in data is quadratic,
-     since both strings can be arbitrarily long.  Instead, create a
-     from-to mapping in one pass of from, then use that map in one
-     pass of data, for linear behavior.  Traditional behavior is that
-     only the first instance of a character in from is consulted,
-     hence the found map.  */
-  memset (map, 0, sizeof map);
-  memset (found, 0, sizeof found);
-  for ( ; (ch = *from) != '\0'; from++)
+/*------------------------------------------------------------------.
+| The macro "joinargs" expands to its second and later arguments,   |
+| including empty ones, each separated from the next by the first   |
+| argument.  This is the "joinall" of the manual, in one pass.      |
+`------------------------------------------------------------------*/
+
+static void
+m4_joinargs (struct obstack *obs, int argc, token_data **argv)
+{
+  int i;
+
+  if (bad_argc (argv[0], argc, 2, -1))
+    return;
+
+  for (i = 2; i < argc; i++)
     {
-      if (! found[ch])
+      if (i > 2)
+        obstack_grow (obs, ARG (1), TOKEN_DATA_LEN (argv[1]));
+      obstack_grow (obs, ARG (i), TOKEN_DATA_LEN (argv[i]));
+    }
+}
+
+/*------------------------------------------------------------------.
+| The macro "splitargs" splits its first argument at each           |
+| occurrence of the second, and expands to the pieces, each quoted  |
+| with the current quotes and separated by commas, so that they     |
+| become separate arguments when the expansion is passed to another |
+| macro.  Without a separator, each byte is a piece of its own.     |
+`------------------------------------------------------------------*/
+
+static void
+m4_splitargs (struct obstack *obs, int argc, token_data **argv)
+{
+  const char *data;
+  const char *end;
+  const char *sep;
+  size_t sep_len;
+  const char *p;
+
+  if (bad_argc (argv[0], argc, 2, 3))
+    return;
+
+  data = ARG (1);
+  end = data + TOKEN_DATA_LEN (argv[1]);
+  sep = ARG (2);
+  sep_len = argc > 2 ? TOKEN_DATA_LEN (argv[2]) : 0;
+
+  if (sep_len == 0)
+    {
+      for (p = data; p < end; p++)
         {
-          found[ch] = 1;
-          map[ch] = *to;
+          if (p > data)
+            obstack_1grow (obs, ',');
+          obstack_grow (obs, lquote.string, lquote.length);
+          obstack_1grow (obs, *p);
+          obstack_grow (obs, rquote.string, rquote.length);
         }
-      if (*to != '\0')
-        to++;
+      return;
     }
 
-  for (data = ARG (1); (ch = *data) != '\0'; data++)
+  while (true)
     {
-      if (! found[ch])
-        obstack_1grow (obs, ch);
-      else if (map[ch])
-        obstack_1grow (obs, map[ch]);
+      p = find_substring (data, end - data, sep, sep_len);
+      obstack_grow (obs, lquote.string, lquote.length);
+      obstack_grow (obs, data, (p ? p : end) - data);
+      obstack_grow (obs, rquote.string, rquote.length);
+      if (!p)
+        break;
+      obstack_1grow (obs, ',');
+      data = p + sep_len;
     }
 }
 
+/*-----------------------------------------------------------------.
+| The macro "repeat" expands to the first argument repeated as     |
+| many times as the second argument says.  The whole result is     |
+| reserved at once, and filled by copying what is already there,   |
+| doubling each time.                                              |
+`-----------------------------------------------------------------*/
+
+static void
+m4_repeat (struct obstack *obs, int argc, token_data **argv)
+{
+  size_t len;
+  size_t total;
+  size_t done;
+  int count;
+  char *out;
+
+  if (bad_argc (argv[0], argc, 3, 3))
+    return;
+  if (!numeric_arg (argv[0], ARG (2), &count))
+    return;
+  if (count < 0)
+    {
+      M4ERROR ((warning_status, 0,
+                _("negative count to builtin `%s'"),
+                TOKEN_DATA_TEXT (argv[0])));
+      return;
+    }
+
+  len = TOKEN_DATA_LEN (argv[1]);
+  if (count == 0 || len == 0)
+    return;
+  if (SIZE_MAX / count < len)
+    xalloc_die ();
+  total = len * count;
+
+  obstack_blank (obs, total);
+  out = (char *) obstack_next_free (obs) - total;
+  memcpy (out, ARG (1), len);
+  for (done = len; done < total; done *= 2)
+    memcpy (out + done, out, done < total - done ? done : total - done);
+}
+
+/*------------------------------------------------------------------.
+| Expand to the first argument with its ASCII letters changed to    |
+| upper case if UPPER, else to lower case.  This is the common code |
+| for "uppercase" and "lowercase".                                  |
+`------------------------------------------------------------------*/
+
+static void
+change_case (struct obstack *obs, int argc, token_data **argv, bool upper)
+{
+  const char *data;
+  size_t len;
+  size_t i;
+  char *out;
+
+  if (bad_argc (argv[0], argc, 2, 2))
+    return;
+
+  data = ARG (1);
+  len = TOKEN_DATA_LEN (argv[1]);
+  obstack_blank (obs, len);
+  out = (char *) obstack_next_free (obs) - len;
+  if (upper)
+    for (i = 0; i < len; i++)
+      out[i] = c_toupper (to_uchar (data[i]));
+  else
+    for (i = 0; i < len; i++)
+      out[i] = c_tolower (to_uchar (data[i]));
+}
+
+static void
+m4_uppercase (struct obstack *obs, int argc, token_data **argv)
+{
+  change_case (obs, argc, argv, true);
+}
+
+static void
+m4_lowercase (struct obstack *obs, int argc, token_data **argv)
+{
+  change_case (obs, argc, argv, false);
+}
+
 /*-------------------------------------------------------------------.
 | Frontend for printf like formatting.  The function format () lives |
 | in the file format.c.                                              |
@@ -2215,31 +2825,349 @@ m4_placeholder (struct obstack *obs MAYBE_UNUSED, int argc,
 builtin `%s' requested by frozen file is not supported"), ARG (0)));
 }
 
+/* A user macro whose definition is a chain of ifelse comparing one
+   argument with fixed strings, such as
+
+     ifelse(`$1', `a', `...', `$1', `b', `...', `...')
+
+   is expanded with a lookup in a hash table of those strings, instead
+   of by rescanning the whole chain.  The table is built at the first
+   call, for the quotes in effect then, and points into the definition.
+   It is kept in a single block of memory, which free () releases.  */
+
+typedef struct ifelse_case ifelse_case;
+struct ifelse_case
+{
+  const char *key;              /* fixed string, or NULL if free */
+  size_t key_len;
+  const char *branch;           /* text between the quotes */
+  size_t branch_len;
+};
+
+struct ifelse_dispatch
+{
+  char lquote;                  /* quotes of the definition */
+  char rquote;
+  int arg;                      /* argument compared, or -1 if none */
+  char *name;                   /* name of ifelse in the definition */
+  const char *otherwise;        /* last branch, or NULL if none */
+  size_t otherwise_len;
+  size_t mask;                  /* size of cases, less one */
+  ifelse_case *cases;
+};
+
+/* Quoted strings of an ifelse chain, while it is parsed.  */
+typedef struct ifelse_span ifelse_span;
+struct ifelse_span
+{
+  const char *text;
+  size_t len;
+};
+
+static size_t ATTRIBUTE_PURE
+ifelse_hash (const char *s, size_t len)
+{
+  size_t val = 0;
+
+  while (len--)
+    val = (val << 7) + (val >> (sizeof (val) * CHAR_BIT - 7))
+      + to_uchar (*s++);
+  return val;
+}
+
 /*-------------------------------------------------------------------.
-| This function handles all expansion of user defined and predefined |
-| macros.  It is called with an obstack OBS, where the macros        |
-| expansion will be placed, as an unfinished object.  SYM points to  |
-| the macro definition, giving the expansion text.  ARGC and ARGV    |
-| are the arguments, as usual.                                       |
+| Return true if the current syntax lets a definition made of a word |
+| and single character quotes be read back the way parse_ifelse ()   |
+| reads it: only the quotes can start a string, no comment can start |
+| where a word, a quote or a separator is expected, and no quote can |
+| be taken as part of a reference to an argument.                    |
 `-------------------------------------------------------------------*/
 
-void
-expand_user_macro (struct obstack *obs, symbol *sym,
-                   int argc, token_data **argv)
+static bool
+ifelse_syntax (void)
+{
+  unsigned char lq, rq, bc;
+
+  if (lquote.length != 1 || rquote.length != 1 || !default_word_syntax ())
+    return false;
+  lq = to_uchar (*lquote.string);
+  rq = to_uchar (*rquote.string);
+  if (!lq || c_isalnum (lq) || lq == '_' || c_isspace (lq)
+      || strchr ("(),$#*@", lq))
+    return false;
+  if (!rq || c_isalnum (rq) || rq == '_' || c_isspace (rq)
+      || strchr ("(),$#*@", rq))
+    return false;
+  if (!bcomm.length)
+    return true;
+  bc = to_uchar (*bcomm.string);
+  return !(c_isalnum (bc) || bc == '_' || c_isspace (bc)
+           || strchr ("(),", bc) || bc == lq);
+}
+
+/*-------------------------------------------------------------------.
+| Return the argument number N if TEXT, of length LEN, is exactly $N |
+| as expand_user_macro () reads it, and -1 otherwise.                |
+`-------------------------------------------------------------------*/
+
+static int ATTRIBUTE_PURE
+ifelse_parameter (const char *text, size_t len)
+{
+  int i = 0;
+
+  if (len < 2 || *text != '$' || len > (no_gnu_extensions ? 2 : 6))
+    return -1;
+  while (--len)
+    {
+      if (!c_isdigit (*++text))
+        return -1;
+      i = i * 10 + *text - '0';
+    }
+  return i;
+}
+
+/*-------------------------------------------------------------------.
+| Parse TEXT, the definition of a user macro, as a chain of ifelse,  |
+| with the current quotes, which ifelse_syntax () accepted.  Return  |
+| a new dispatch table, which only records the quotes if TEXT is not |
+| a chain that a table can handle.                                   |
+`-------------------------------------------------------------------*/
+
+static struct ifelse_dispatch *
+parse_ifelse (const char *text)
+{
+  char lq = *lquote.string;
+  char rq = *rquote.string;
+  struct ifelse_dispatch *d;
+  ifelse_span *spans = NULL;
+  size_t nspans = 0;
+  size_t spans_size = 0;
+  size_t name_len;
+  size_t ncases;
+  size_t size;
+  size_t i;
+  const char *p = text;
+  int arg = -1;
+
+  /* The name of the macro, and an open parenthesis.  */
+  if (c_isalpha (*p) || *p == '_')
+    while (c_isalnum (*p) || *p == '_')
+      p++;
+  name_len = p - text;
+  if (!name_len || *p++ != '(')
+    goto fail;
+
+  /* Quoted arguments, each followed by a comma or by the final close
+     parenthesis.  */
+  while (1)
+    {
+      int level = 1;
+      const char *start;
+
+      while (c_isspace (*p))
+        p++;
+      if (*p++ != lq)
+        goto fail;
+      start = p;
+      for (; level; p++)
+        if (*p == '\0')
+          goto fail;
+        else if (*p == rq)
+          level--;
+        else if (*p == lq)
+          level++;
+
+      if (nspans == spans_size)
+        spans = x2nrealloc (spans, &spans_size, sizeof *spans);
+      spans[nspans].text = start;
+      spans[nspans++].len = p - 1 - start;
+      if (*p == ')' && p[1] == '\0')
+        break;
+      if (*p++ != ',')
+        goto fail;
+    }
+
+  /* Each test compares the same argument with a fixed string, and
+     there are no excess arguments for ifelse to warn about.  */
+  if (nspans < 3 || nspans % 3 == 2)
+    goto fail;
+  ncases = nspans / 3;
+  for (i = 0; i < ncases; i++)
+    {
+      ifelse_span *test = &spans[3 * i];
+      ifelse_span key = test[1];
+      int n = ifelse_parameter (test[0].text, test[0].len);
+
+      if (n < 0)
+        {
+          n = ifelse_parameter (test[1].text, test[1].len);
+          key = test[0];
+        }
+      if (n < 0 || (arg >= 0 && n != arg) || memchr (key.text, '$', key.len))
+        goto fail;
+      arg = n;
+      test[0] = key;
+    }
+
+  for (size = 2; size < 2 * ncases; size *= 2)
+    ;
+  d = (struct ifelse_dispatch *) xmalloc (sizeof *d + size * sizeof *d->cases
+                                          + name_len + 1);
+  d->cases = (ifelse_case *) (d + 1);
+  d->name = (char *) (d->cases + size);
+  memcpy (d->name, text, name_len);
+  d->name[name_len] = '\0';
+  d->mask = size - 1;
+  for (i = 0; i < size; i++)
+    d->cases[i].key = NULL;
+
+  /* On duplicate keys, the first test wins, as in ifelse.  */
+  for (i = 0; i < ncases; i++)
+    {
+      ifelse_span *key = &spans[3 * i];
+      size_t h = ifelse_hash (key->text, key->len) & d->mask;
+      ifelse_case *c;
+
+      while ((c = &d->cases[h])->key != NULL
+             && !(c->key_len == key->len
+                  && memcmp (c->key, key->text, key->len) == 0))
+        h = (h + 1) & d->mask;
+      if (c->key == NULL)
+        {
+          c->key = key->text;
+          c->key_len = key->len;
+          c->branch = key[2].text;
+          c->branch_len = key[2].len;
+        }
+    }
+  if (nspans % 3)
+    {
+      d->otherwise = spans[nspans - 1].text;
+      d->otherwise_len = spans[nspans - 1].len;
+    }
+  else
+    d->otherwise = NULL;
+  d->arg = arg;
+  d->lquote = lq;
+  d->rquote = rq;
+  free (spans);
+  return d;
+
+ fail:
+  free (spans);
+  d = (struct ifelse_dispatch *) xzalloc (sizeof *d);
+  d->arg = -1;
+  d->lquote = lq;
+  d->rquote = rq;
+  return d;
+}
+
+/*-------------------------------------------------------------------.
+| Return true if TEXT, of length LEN, has as many left quotes as     |
+| right quotes, with never more of the latter, so that putting it    |
+| between quotes does not change where the string ends.              |
+`-------------------------------------------------------------------*/
+
+static bool ATTRIBUTE_PURE
+balanced_quotes (const char *text, size_t len, char lq, char rq)
+{
+  const char *end = text + len;
+  int level = 0;
+
+  while ((text = (const char *) memchr2 (text, lq, rq, end - text)))
+    if (*text++ == rq ? --level < 0 : (level++, false))
+      return false;
+  return level == 0;
+}
+
+static void substitute_args (struct obstack *, const char *, const char *,
+                             int, token_data **);
+
+/*-------------------------------------------------------------------.
+| Expand the call of SYM, a user macro, on OBS with a lookup in the  |
+| ifelse dispatch table of its definition, and return true; or else, |
+| return false if the definition is not a chain that the table can   |
+| handle, or if this call could behave differently from rescanning   |
+| the definition: SYM or ifelse is traced, ifelse is redefined,      |
+| calls are profiled, or an argument could change the meaning of the |
+| quotes around it.                                                  |
+`-------------------------------------------------------------------*/
+
+static bool
+dispatch_ifelse (struct obstack *obs, symbol *sym, int argc,
+                 token_data **argv)
+{
+  struct ifelse_dispatch *d = SYMBOL_DISPATCH (sym);
+  symbol *ifelse;
+  const char *key = "";
+  size_t key_len = 0;
+  size_t h;
+  int i;
+
+  if (!ifelse_syntax ())
+    return false;
+  if (d == NULL || d->lquote != *lquote.string || d->rquote != *rquote.string)
+    {
+      free (d);
+      d = SYMBOL_DISPATCH (sym) = parse_ifelse (SYMBOL_TEXT (sym));
+    }
+  if (d->arg < 0 || profiling || (debug_level & DEBUG_TRACE_ALL)
+      || SYMBOL_TRACED (sym) || trace_json_active ())
+    return false;
+
+  ifelse = lookup_symbol (d->name, SYMBOL_LOOKUP);
+  if (ifelse == NULL || SYMBOL_TYPE (ifelse) != TOKEN_FUNC
+      || SYMBOL_FUNC (ifelse) != m4_ifelse || SYMBOL_TRACED (ifelse))
+    return false;
+  for (i = 1; i < argc; i++)
+    if (!balanced_quotes (TOKEN_DATA_TEXT (argv[i]), TOKEN_DATA_LEN (argv[i]),
+                          d->lquote, d->rquote))
+      return false;
+
+  if (d->arg < argc)
+    {
+      key = TOKEN_DATA_TEXT (argv[d->arg]);
+      key_len = TOKEN_DATA_LEN (argv[d->arg]);
+    }
+  for (h = ifelse_hash (key, key_len) & d->mask; d->cases[h].key != NULL;
+       h = (h + 1) & d->mask)
+    if (d->cases[h].key_len == key_len
+        && memcmp (d->cases[h].key, key, key_len) == 0)
+      {
+        substitute_args (obs, d->cases[h].branch,
+                         d->cases[h].branch + d->cases[h].branch_len,
+                         argc, argv);
+        break;
+      }
+  if (d->cases[h].key == NULL && d->otherwise != NULL)
+    substitute_args (obs, d->otherwise, d->otherwise + d->otherwise_len,
+                     argc, argv);
+  stats.ifelse_dispatches++;
+  return true;
+}
+
+/*-------------------------------------------------------------------.
+| Put on OBS the text from TEXT to END of a user macro definition,   |
+| with references to the arguments ARGC and ARGV replaced by their   |
+| values.                                                            |
+`-------------------------------------------------------------------*/
+
+static void
+substitute_args (struct obstack *obs, const char *text, const char *end,
+                 int argc, token_data **argv)
 {
-  const char *text = SYMBOL_TEXT (sym);
   int i;
   while (1)
     {
-      const char *dollar = strchr (text, '$');
+      const char *dollar = (const char *) memchr (text, '$', end - text);
       if (!dollar)
         {
-          obstack_grow (obs, text, strlen (text));
+          obstack_grow (obs, text, end - text);
           return;
         }
       obstack_grow (obs, text, dollar - text);
-      text = dollar;
-      switch (*++text)
+      text = dollar + 1;
+      switch (text < end ? *text : '\0')
         {
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
@@ -2249,7 +3177,7 @@ expand_user_macro (struct obstack *obs, symbol *sym,
             }
           else
             {
-              for (i = 0; c_isdigit (*text); text++)
+              for (i = 0; text < end && c_isdigit (*text); text++)
                 {
                   /* Check for overflow.  (a*b > c iff a > floor (c/b)) */
                   int d = *text - '0';
@@ -2260,7 +3188,7 @@ expand_user_macro (struct obstack *obs, symbol *sym,
                   else
                     {
                       i = argc;
-                      while (c_isdigit (*text))
+                      while (text < end && c_isdigit (*text))
                         {
                           text++;
                         }
@@ -2270,7 +3198,7 @@ expand_user_macro (struct obstack *obs, symbol *sym,
             }
           if (i < argc)
             obstack_grow (obs, TOKEN_DATA_TEXT (argv[i]),
-                          strlen (TOKEN_DATA_TEXT (argv[i])));
+                          TOKEN_DATA_LEN (argv[i]));
           break;
 
         case '#': /* number of arguments */
@@ -2290,3 +3218,21 @@ expand_user_macro (struct obstack *obs, symbol *sym,
         }
     }
 }
+
+/*-------------------------------------------------------------------.
+| This function handles all expansion of user defined and predefined |
+| macros.  It is called with an obstack OBS, where the macros        |
+| expansion will be placed, as an unfinished object.  SYM points to  |
+| the macro definition, giving the expansion text.  ARGC and ARGV    |
+| are the arguments, as usual.                                       |
+`-------------------------------------------------------------------*/
+
+void
+expand_user_macro (struct obstack *obs, symbol *sym,
+                   int argc, token_data **argv)
+{
+  const char *text = SYMBOL_TEXT (sym);
+
+  if (!dispatch_ifelse (obs, sym, argc, argv))
+    substitute_args (obs, text, text + strlen (text), argc, argv);
+}
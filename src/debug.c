@@ -21,8 +21,14 @@
 
 #include "m4.h"
 
+#include <signal.h>
 #include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#if HAVE_GETRUSAGE
+# include <sys/resource.h>
+#endif
+#include <time.h>
 
 /* File for debugging output.  */
 FILE *debug = NULL;
@@ -30,7 +36,17 @@ FILE *debug = NULL;
 /* Obstack for trace messages.  */
 static struct obstack trace;
 
+/* File for trace records of --trace-json, or NULL for text traces.  */
+static FILE *trace_json_file;
+
+/* Time of the first trace record, and of the current call.  */
+static uintmax_t trace_json_epoch;
+static uintmax_t trace_json_start;
+
 static void debug_set_file (FILE *);
+static void trace_json_record (const char *, int, int, token_data **,
+                               const char *);
+static uintmax_t profile_clock (void);
 
 /*----------------------------------.
 | Initialise the debugging module.  |
@@ -112,8 +128,10 @@ debug_decode (const char *opts)
     }
 
   /* This is to avoid screwing up the trace output due to changes in the
-     debug_level.  */
+     debug_level.  The records of --trace-json pending on the same
+     obstack are complete, and must be written first.  */
 
+  trace_json_flush ();
   obstack_free (&trace, obstack_finish (&trace));
 
   return level;
@@ -138,13 +156,10 @@ debug_set_file (FILE *fp)
     }
   debug = fp;
 
-  if (debug != NULL && debug != stdout)
+  if (debug != NULL && debug != stdout
+      && fstat (STDOUT_FILENO, &stdout_stat) == 0
+      && fstat (fileno (debug), &debug_stat) == 0)
     {
-      if (fstat (STDOUT_FILENO, &stdout_stat) < 0)
-        return;
-      if (fstat (fileno (debug), &debug_stat) < 0)
-        return;
-
       /* mingw has a bug where fstat on a regular file reports st_ino
          of 0.  On normal system, st_ino should never be 0.  */
       if (stdout_stat.st_ino == debug_stat.st_ino
@@ -160,6 +175,7 @@ debug_set_file (FILE *fp)
           debug = stdout;
         }
     }
+  output_share_stdout (debug == stdout);
 }
 
 /*-----------------------------------------------------------.
@@ -169,6 +185,8 @@ debug_set_file (FILE *fp)
 void
 debug_flush_files (void)
 {
+  output_flush ();
+  trace_json_flush ();
   fflush (stdout);
   fflush (stderr);
   if (debug != NULL && debug != stdout && debug != stderr)
@@ -354,6 +372,8 @@ trace_flush (void)
 void
 trace_prepre (const char *name, int id)
 {
+  if (trace_json_file != NULL)
+    return;
   trace_header (id);
   trace_format ("%s ...", name);
   trace_flush ();
@@ -370,6 +390,12 @@ trace_pre (const char *name, int id, int argc, token_data **argv)
   int i;
   const builtin *bp;
 
+  if (trace_json_file != NULL)
+    {
+      trace_json_start = profile_clock ();
+      return;
+    }
+
   trace_header (id);
   trace_format ("%s", name);
 
@@ -423,8 +449,15 @@ INTERNAL ERROR: builtin not found in builtin table! (trace_pre ())"));
 `-------------------------------------------------------------------*/
 
 void
-trace_post (const char *name, int id, int argc, const char *expanded)
+trace_post (const char *name, int id, int argc, token_data **argv,
+            const char *expanded)
 {
+  if (trace_json_file != NULL)
+    {
+      trace_json_record (name, id, argc, argv, expanded);
+      return;
+    }
+
   if (debug_level & DEBUG_TRACE_CALL)
     {
       trace_header (id);
@@ -435,3 +468,768 @@ trace_post (const char *name, int id, int argc, const char *expanded)
     trace_format (" -> %l%S%r", expanded);
   trace_flush ();
 }
+
+
+/* With --trace-json, each traced macro call produces one line holding
+   a JSON object, instead of text trace lines.  Records are collected
+   on the trace obstack, and written in bulk once enough of them have
+   accumulated, when files are serialized, and at exit.  */
+
+/* Amount of trace records worth writing at once.  */
+#define TRACE_JSON_BUFFER_SIZE (1024 * 1024)
+
+/*-----------------------------------------------------------------.
+| Append to the current trace record the first LENGTH bytes of S,  |
+| as a JSON string.  Bytes outside of ASCII are copied unchanged.  |
+`-----------------------------------------------------------------*/
+
+static void
+trace_json_string (const char *s, size_t length)
+{
+  char buf[sizeof "\\u0000"];
+  const char *end = s + length;
+  const char *span;
+  unsigned char ch;
+
+  obstack_1grow (&trace, '"');
+  while (s < end)
+    {
+      /* Copy runs of characters needing no escape at once.  */
+      for (span = s; s < end; s++)
+        {
+          ch = *s;
+          if (ch < ' ' || ch == '"' || ch == '\\' || ch == 0x7f)
+            break;
+        }
+      obstack_grow (&trace, span, s - span);
+      if (s == end)
+        break;
+
+      ch = *s++;
+      if (ch == '"' || ch == '\\')
+        {
+          obstack_1grow (&trace, '\\');
+          obstack_1grow (&trace, ch);
+        }
+      else if (ch == '\n')
+        obstack_grow (&trace, "\\n", 2);
+      else if (ch == '\t')
+        obstack_grow (&trace, "\\t", 2);
+      else
+        {
+          sprintf (buf, "\\u%04x", ch);
+          obstack_grow (&trace, buf, 6);
+        }
+    }
+  obstack_1grow (&trace, '"');
+}
+
+/*---------------------------------------------------------------.
+| Append KEY, then the decimal digits of N, to the current trace |
+| record.                                                        |
+`---------------------------------------------------------------*/
+
+static void
+trace_json_number (const char *key, uintmax_t n)
+{
+  char buf[INT_BUFSIZE_BOUND (uintmax_t)];
+  char *p = buf + sizeof buf;
+
+  do
+    *--p = '0' + n % 10;
+  while ((n /= 10) != 0);
+  obstack_grow (&trace, key, strlen (key));
+  obstack_grow (&trace, p, buf + sizeof buf - p);
+}
+
+/*-----------------------------------------------------------------.
+| Append the text S to the current trace record, as the member     |
+| KEY, holding the text truncated to --arglength, followed by the  |
+| member LENGTH_KEY, holding its full length.                      |
+`-----------------------------------------------------------------*/
+
+static void
+trace_json_text (const char *key, const char *length_key, const char *s)
+{
+  size_t length = strlen (s);
+
+  obstack_grow (&trace, key, strlen (key));
+  if (max_debug_argument_length > 0
+      && length > (size_t) max_debug_argument_length)
+    trace_json_string (s, max_debug_argument_length);
+  else
+    trace_json_string (s, length);
+  trace_json_number (length_key, length);
+}
+
+/*---------------------------------------------------------------.
+| Append a record for the call ID of macro NAME, with ARGC       |
+| arguments in ARGV, and expanding to EXPANDED, to the pending   |
+| trace records.  Arguments and expansion are only shown as      |
+| requested by the debug flags `a' and `e'.  Times are in        |
+| nanoseconds since the first trace.                             |
+`---------------------------------------------------------------*/
+
+static void
+trace_json_record (const char *name, int id, int argc, token_data **argv,
+                   const char *expanded)
+{
+  uintmax_t end = profile_clock ();
+  const builtin *bp;
+  int i;
+
+  trace_json_number ("{\"id\":", id);
+  trace_json_number (",\"depth\":", expansion_level);
+  obstack_grow (&trace, ",\"name\":", 8);
+  trace_json_string (name, strlen (name));
+  obstack_grow (&trace, ",\"file\":", 8);
+  trace_json_string (current_file, current_line ? strlen (current_file) : 0);
+  trace_json_number (",\"line\":", current_line);
+
+  if (debug_level & DEBUG_TRACE_ARGS)
+    {
+      obstack_grow (&trace, ",\"args\":[", 9);
+      for (i = 1; i < argc; i++)
+        {
+          if (i != 1)
+            obstack_1grow (&trace, ',');
+          switch (TOKEN_DATA_TYPE (argv[i]))
+            {
+            case TOKEN_TEXT:
+              trace_json_text ("{\"text\":", ",\"len\":",
+                               TOKEN_DATA_TEXT (argv[i]));
+              break;
+
+            case TOKEN_FUNC:
+              bp = find_builtin_by_addr (TOKEN_DATA_FUNC (argv[i]));
+              if (bp == NULL)
+                {
+                  M4ERROR ((warning_status, 0, "\
+INTERNAL ERROR: builtin not found in builtin table! (trace_json_record ())"));
+                  abort ();
+                }
+              obstack_grow (&trace, "{\"builtin\":", 11);
+              trace_json_string (bp->name, strlen (bp->name));
+              break;
+
+            case TOKEN_VOID:
+            default:
+              M4ERROR ((warning_status, 0, "\
+INTERNAL ERROR: bad token data type (trace_json_record ())"));
+              abort ();
+            }
+          obstack_1grow (&trace, '}');
+        }
+      obstack_1grow (&trace, ']');
+    }
+
+  if (debug_level & DEBUG_TRACE_EXPANSION)
+    trace_json_text (",\"expansion\":", ",\"expansion_len\":",
+                     expanded ? expanded : "");
+
+  trace_json_number (",\"start\":", trace_json_start - trace_json_epoch);
+  trace_json_number (",\"end\":", end - trace_json_epoch);
+  obstack_grow (&trace, "}\n", 2);
+
+  if (obstack_object_size (&trace) >= TRACE_JSON_BUFFER_SIZE)
+    trace_json_flush ();
+}
+
+/*-----------------------------------------------------------.
+| Return true if traced expansions are written as records of |
+| --trace-json, rather than as trace lines.                  |
+`-----------------------------------------------------------*/
+
+bool
+trace_json_active (void)
+{
+  return trace_json_file != NULL;
+}
+
+/*-------------------------------------------------.
+| Write all pending trace records of --trace-json. |
+`-------------------------------------------------*/
+
+void
+trace_json_flush (void)
+{
+  size_t length;
+
+  if (trace_json_file == NULL)
+    return;
+  length = obstack_object_size (&trace);
+  if (length > 0
+      && fwrite (obstack_base (&trace), 1, length, trace_json_file) != length)
+    {
+      M4ERROR ((warning_status, errno, _("error writing trace records")));
+      retcode = EXIT_FAILURE;
+    }
+  obstack_free (&trace, obstack_finish (&trace));
+}
+
+/* Write the last records, and close the file.  Registered with
+   atexit () by trace_json_init ().  */
+static void
+trace_json_close (void)
+{
+  trace_json_flush ();
+  if (close_stream (trace_json_file) != 0)
+    error (0, errno, _("error writing trace records"));
+  trace_json_file = NULL;
+}
+
+/*-------------------------------------------------------------------.
+| Write trace records to file NAME, as JSON lines, instead of trace  |
+| lines to the debug stream.                                         |
+`-------------------------------------------------------------------*/
+
+void
+trace_json_init (const char *name)
+{
+  trace_json_file = fopen (name, "we");
+  if (trace_json_file == NULL)
+    m4_failure (errno, _("cannot open `%s'"), name);
+
+  /* Records are already written in bulk.  */
+  setvbuf (trace_json_file, NULL, _IONBF, 0);
+  trace_json_epoch = profile_clock ();
+  if (atexit (trace_json_close) != 0)
+    M4ERROR ((warning_status, 0,
+              "INTERNAL ERROR: unable to register trace file"));
+}
+
+/* The rest of this file contains the expansion profilers of --profile
+   and --profile-stacks.  Statistics are kept per macro name, in a
+   private hash table keyed by the hash values the symbol table already
+   computed, and reported when m4 exits.  Stack samples are kept per
+   distinct stack of expansions, likewise.  */
+
+/* Statistics of all the expansions of one macro name.  */
+typedef struct macro_profile macro_profile;
+struct macro_profile
+{
+  macro_profile *next;          /* next name in the same bucket */
+  char *name;                   /* macro name */
+  size_t hash;                  /* hash value of name */
+  unsigned long int calls;      /* number of expansions */
+  unsigned long int rescans;    /* expansions pushed back for rescanning */
+  uintmax_t total;              /* inclusive time, in nanoseconds */
+  uintmax_t self;               /* exclusive time, in nanoseconds */
+  uintmax_t arg_bytes;          /* bytes of collected arguments */
+  uintmax_t expansion_bytes;    /* bytes of expansion text */
+  int active;                   /* frames of this name being expanded */
+};
+
+#define PROFILE_TABLE_SIZE 1021
+
+/* True if --profile or --profile-stacks is in effect.  */
+bool profiling = false;
+
+/* The innermost macro being expanded, when profiling.  */
+macro_frame *current_frame = NULL;
+
+/* Where the report of --profile is written, or NULL.  */
+static FILE *profile_file;
+
+static macro_profile *profile_table[PROFILE_TABLE_SIZE];
+static size_t profile_count;
+
+/*-----------------------------------------------------------.
+| Return a timestamp in nanoseconds, for measuring elapsed   |
+| time only.                                                 |
+`-----------------------------------------------------------*/
+
+static uintmax_t
+profile_clock (void)
+{
+  struct timeval tv;
+
+#if HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec * (uintmax_t) 1000000000 + ts.tv_nsec;
+#endif /* HAVE_CLOCK_GETTIME */
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * (uintmax_t) 1000000000 + tv.tv_usec * 1000;
+}
+
+/* Order profile records by decreasing exclusive time, then by
+   decreasing number of calls, then by name.  */
+static int
+profile_compare (const void *a, const void *b)
+{
+  const macro_profile *p = *(macro_profile *const *) a;
+  const macro_profile *q = *(macro_profile *const *) b;
+
+  if (p->self != q->self)
+    return p->self < q->self ? 1 : -1;
+  if (p->calls != q->calls)
+    return p->calls < q->calls ? 1 : -1;
+  return strcmp (p->name, q->name);
+}
+
+/*-----------------------------------------------------------------.
+| Print the statistics of all macros expanded, most costly first.  |
+| Registered with atexit () by profile_init ().                    |
+`-----------------------------------------------------------------*/
+
+static void
+profile_report (void)
+{
+  macro_profile **sorted;
+  macro_profile *p;
+  size_t i, n;
+
+  if (profile_file == NULL)
+    return;
+  sorted = XNMALLOC (profile_count, macro_profile *);
+  for (i = n = 0; i < PROFILE_TABLE_SIZE; i++)
+    for (p = profile_table[i]; p != NULL; p = p->next)
+      sorted[n++] = p;
+  qsort (sorted, n, sizeof *sorted, profile_compare);
+
+  xfprintf (profile_file, "%10s %12s %12s %12s %12s %10s  %s\n",
+            "calls", "total(s)", "self(s)", "arg-bytes", "exp-bytes",
+            "rescans", "macro");
+  for (i = 0; i < n; i++)
+    {
+      p = sorted[i];
+      xfprintf (profile_file, "%10lu %12.6f %12.6f %12ju %12ju %10lu  %s\n",
+                p->calls, p->total / 1e9, p->self / 1e9, p->arg_bytes,
+                p->expansion_bytes, p->rescans, p->name);
+    }
+  free (sorted);
+
+  if (profile_file == stderr)
+    fflush (stderr);
+  else if (close_stream (profile_file) != 0)
+    error (0, errno, _("error writing profile"));
+}
+
+/*----------------------------------------------------------------.
+| Start profiling macro expansions, writing the report to file    |
+| NAME at exit, or to stderr if NAME is NULL.                     |
+`----------------------------------------------------------------*/
+
+void
+profile_init (const char *name)
+{
+  if (name == NULL)
+    profile_file = stderr;
+  else
+    {
+      profile_file = fopen (name, "we");
+      if (profile_file == NULL)
+        m4_failure (errno, _("cannot open `%s'"), name);
+    }
+  profiling = true;
+  if (atexit (profile_report) != 0)
+    M4ERROR ((warning_status, 0,
+              "INTERNAL ERROR: unable to register profile report"));
+}
+
+/* Number of SIGPROF ticks of --profile-stacks not yet charged to an
+   expansion stack.  The signal handler does nothing else; the ticks
+   are charged by sample_stack () the next time the stack changes, to
+   the stack that was current when they arrived.  */
+static volatile sig_atomic_t sample_ticks;
+
+/* Interval between two samples, in microseconds of CPU time.  */
+#define SAMPLE_INTERVAL 1000
+
+/* Number of samples taken for one distinct expansion stack.  */
+typedef struct stack_sample stack_sample;
+struct stack_sample
+{
+  stack_sample *next;           /* next stack in the same bucket */
+  size_t hash;                  /* hash value of stack */
+  uintmax_t count;              /* number of samples */
+  char *stack;                  /* frames, outermost first */
+};
+
+/* Where the samples of --profile-stacks are written, or NULL.  */
+static FILE *sample_file;
+
+static stack_sample *sample_table[PROFILE_TABLE_SIZE];
+static struct obstack sample_obstack;
+
+/* The current frames, outermost first, while sampling.  */
+static macro_frame **sample_frames;
+static size_t sample_frames_allocated;
+
+#if HAVE_SETITIMER
+
+/* Count a tick of the SIGPROF timer.  */
+static void
+sample_tick (int signo MAYBE_UNUSED)
+{
+  sample_ticks++;
+}
+
+#endif /* HAVE_SETITIMER */
+
+/*------------------------------------------------------------------.
+| Charge the pending ticks to the current expansion stack, written  |
+| in the collapsed format of flame graph tools: the frames from the |
+| outermost, each as the macro name followed by the location of the |
+| call, separated by semicolons.                                    |
+`------------------------------------------------------------------*/
+
+static void
+sample_stack (void)
+{
+  int ticks = sample_ticks;
+  macro_frame *frame;
+  stack_sample **bucket;
+  stack_sample *sample;
+  const char *stack;
+  const char *p;
+  char buf[INT_BUFSIZE_BOUND (int) + 2];
+  size_t depth = 0;
+  size_t i;
+  size_t h = 0;
+
+  sample_ticks -= ticks;
+
+  for (frame = current_frame; frame != NULL; frame = frame->caller)
+    depth++;
+  if (sample_frames_allocated < depth)
+    {
+      free (sample_frames);
+      sample_frames_allocated = depth * 2;
+      sample_frames = XNMALLOC (sample_frames_allocated, macro_frame *);
+    }
+  for (frame = current_frame, i = depth; frame != NULL;
+       frame = frame->caller)
+    sample_frames[--i] = frame;
+
+  obstack_grow (&sample_obstack, "m4", 2);
+  for (i = 0; i < depth; i++)
+    {
+      frame = sample_frames[i];
+      obstack_1grow (&sample_obstack, ';');
+      obstack_grow (&sample_obstack, frame->name, strlen (frame->name));
+      obstack_grow (&sample_obstack, " (", 2);
+      if (frame->file != NULL)
+        obstack_grow (&sample_obstack, frame->file, strlen (frame->file));
+      sprintf (buf, ":%d)", frame->line);
+      obstack_grow (&sample_obstack, buf, strlen (buf));
+    }
+  obstack_1grow (&sample_obstack, '\0');
+  stack = (char *) obstack_finish (&sample_obstack);
+
+  for (p = stack; *p; p++)
+    h = h * 31 + to_uchar (*p);
+  bucket = &sample_table[h % PROFILE_TABLE_SIZE];
+  for (sample = *bucket; sample != NULL; sample = sample->next)
+    if (sample->hash == h && STREQ (sample->stack, stack))
+      break;
+  if (sample == NULL)
+    {
+      sample = XZALLOC (stack_sample);
+      sample->hash = h;
+      sample->stack = xstrdup (stack);
+      sample->next = *bucket;
+      *bucket = sample;
+    }
+  sample->count += ticks;
+  obstack_free (&sample_obstack, (char *) stack);
+}
+
+#if HAVE_SETITIMER
+
+/*--------------------------------------------------------------.
+| Stop sampling and write all the samples of --profile-stacks.  |
+| Registered with atexit () by profile_stacks_init ().          |
+`--------------------------------------------------------------*/
+
+static void
+sample_report (void)
+{
+  stack_sample *sample;
+  size_t i;
+  struct itimerval timer;
+
+  memset (&timer, 0, sizeof timer);
+  setitimer (ITIMER_PROF, &timer, NULL);
+  if (sample_file == NULL)
+    return;
+  if (sample_ticks)
+    sample_stack ();
+
+  for (i = 0; i < PROFILE_TABLE_SIZE; i++)
+    for (sample = sample_table[i]; sample != NULL; sample = sample->next)
+      xfprintf (sample_file, "%s %ju\n", sample->stack, sample->count);
+  if (close_stream (sample_file) != 0)
+    error (0, errno, _("error writing profile"));
+}
+
+#endif /* HAVE_SETITIMER */
+
+/*---------------------------------------------------------------.
+| Start sampling the stack of macro expansions with a SIGPROF    |
+| timer, writing the samples to file NAME at exit.               |
+`---------------------------------------------------------------*/
+
+void
+profile_stacks_init (const char *name MAYBE_UNUSED)
+{
+#if HAVE_SETITIMER
+  struct sigaction act;
+  struct itimerval timer;
+
+  sample_file = fopen (name, "we");
+  if (sample_file == NULL)
+    m4_failure (errno, _("cannot open `%s'"), name);
+  obstack_init (&sample_obstack);
+  profiling = true;
+  if (atexit (sample_report) != 0)
+    M4ERROR ((warning_status, 0,
+              "INTERNAL ERROR: unable to register profile report"));
+
+  /* Restart interrupted system calls, so that reading input is not
+     disturbed by the timer.  */
+  sigemptyset (&act.sa_mask);
+  act.sa_flags = SA_RESTART;
+  act.sa_handler = sample_tick;
+  sigaction (SIGPROF, &act, NULL);
+
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = SAMPLE_INTERVAL;
+  timer.it_value = timer.it_interval;
+  if (setitimer (ITIMER_PROF, &timer, NULL) != 0)
+    m4_failure (errno, _("cannot start stack sampling"));
+#else /* !HAVE_SETITIMER */
+  m4_failure (0, _("stack sampling is not supported on this system"));
+#endif /* !HAVE_SETITIMER */
+}
+
+/*-------------------------------------------------------------------.
+| Start the expansion of the macro NAME, whose hash value is H, and  |
+| which is described by the caller's FRAME.  Used from               |
+| expand_macro () before collecting arguments.                       |
+`-------------------------------------------------------------------*/
+
+void
+profile_enter (macro_frame *frame, const char *name, size_t h)
+{
+  macro_profile **bucket;
+  macro_profile *p;
+
+  if (sample_ticks)
+    sample_stack ();
+  frame->name = name;
+  frame->file = current_file;
+  frame->line = current_line;
+  frame->caller = current_frame;
+  current_frame = frame;
+  frame->profile = NULL;
+  if (profile_file == NULL)
+    return;
+
+  bucket = &profile_table[h % PROFILE_TABLE_SIZE];
+  for (p = *bucket; p != NULL; p = p->next)
+    if (p->hash == h && STREQ (p->name, name))
+      break;
+  if (p == NULL)
+    {
+      p = XZALLOC (macro_profile);
+      p->name = xstrdup (name);
+      p->hash = h;
+      p->next = *bucket;
+      *bucket = p;
+      profile_count++;
+    }
+
+  p->calls++;
+  p->active++;
+  frame->profile = p;
+  frame->children = 0;
+  frame->start = profile_clock ();
+}
+
+/*------------------------------------------------------------------.
+| Finish the expansion described by FRAME, whose ARGC arguments are |
+| in ARGV, and which produced EXPANDED (NULL if it is empty), to be |
+| rescanned unless INERT.                                           |
+`------------------------------------------------------------------*/
+
+void
+profile_leave (macro_frame *frame, int argc, token_data **argv,
+               const char *expanded, bool inert)
+{
+  macro_profile *p = frame->profile;
+  uintmax_t elapsed;
+  int i;
+
+  if (sample_ticks)
+    sample_stack ();
+  current_frame = frame->caller;
+  if (p == NULL)
+    return;
+
+  /* Recursive expansions only count once in the inclusive time.  */
+  elapsed = profile_clock () - frame->start;
+  p->self += elapsed - frame->children;
+  if (--p->active == 0)
+    p->total += elapsed;
+  if (current_frame != NULL && current_frame->profile != NULL)
+    current_frame->children += elapsed;
+
+  for (i = 1; i < argc; i++)
+    if (TOKEN_DATA_TYPE (argv[i]) == TOKEN_TEXT)
+      p->arg_bytes += strlen (TOKEN_DATA_TEXT (argv[i]));
+  if (expanded != NULL)
+    {
+      p->expansion_bytes += strlen (expanded);
+      if (!inert)
+        p->rescans++;
+    }
+}
+
+
+/* The rest of this file reports the counters of struct m4_statistics,
+   with the builtin m4stats and with --stats at exit.  */
+
+struct m4_statistics stats;
+
+/* Where --stats writes its report at exit.  */
+static FILE *stats_file;
+
+/* Names of the statistics, in the order of stats_collect ().  */
+static const char *const stats_names[] =
+{
+  "tokens-eof", "tokens-string", "tokens-word", "tokens-open",
+  "tokens-comma", "tokens-close", "tokens-simple", "tokens-macdef",
+  "macro-calls", "max-expansion-level", "pushback-strings",
+  "pushback-bytes", "inert-expansions", "ifelse-dispatches",
+  "diversion-spills", "include-cache-hits", "symbols", "hash-buckets",
+  "hash-buckets-used", "longest-hash-chain", "max-rss"
+};
+
+#define STATS_COUNT (sizeof stats_names / sizeof *stats_names)
+
+verify (TOKEN_MACDEF == 7);
+
+/* Store the current value of every statistic in VALUES.  */
+static void
+stats_collect (uintmax_t values[STATS_COUNT])
+{
+  size_t symbols, used, longest;
+  int i;
+
+  for (i = 0; i <= TOKEN_MACDEF; i++)
+    values[i] = stats.tokens[i];
+  values[i++] = stats.macro_calls;
+  values[i++] = stats.max_expansion_level;
+  values[i++] = stats.pushed_strings;
+  values[i++] = stats.pushed_bytes;
+  values[i++] = stats.inert_expansions;
+  values[i++] = stats.ifelse_dispatches;
+  values[i++] = stats.diversion_spills;
+  values[i++] = stats.include_cache_hits;
+  symtab_load (&symbols, &used, &longest);
+  values[i++] = symbols;
+  values[i++] = hash_table_size;
+  values[i++] = used;
+  values[i++] = longest;
+#if HAVE_GETRUSAGE
+  {
+    struct rusage usage;
+
+    values[i++] = (getrusage (RUSAGE_SELF, &usage) == 0 && usage.ru_maxrss > 0
+                   ? usage.ru_maxrss : 0);
+  }
+#else /* !HAVE_GETRUSAGE */
+  values[i++] = 0;
+#endif /* !HAVE_GETRUSAGE */
+}
+
+/*--------------------------------------------------------------.
+| Store in *VALUE the current value of the statistic NAME, and  |
+| return true, or return false if there is no such statistic.   |
+`--------------------------------------------------------------*/
+
+bool
+stats_value (const char *name, uintmax_t *value)
+{
+  uintmax_t values[STATS_COUNT];
+  size_t i;
+
+  for (i = 0; i < STATS_COUNT; i++)
+    if (STREQ (stats_names[i], name))
+      {
+        stats_collect (values);
+        *value = values[i];
+        return true;
+      }
+  return false;
+}
+
+/*------------------------------------------------.
+| Print all statistics on FILE, one per line.     |
+`------------------------------------------------*/
+
+void
+stats_report (FILE *file)
+{
+  uintmax_t values[STATS_COUNT];
+  size_t i;
+
+  stats_collect (values);
+  for (i = 0; i < STATS_COUNT; i++)
+    xfprintf (file, "%s\t%ju\n", stats_names[i], values[i]);
+}
+
+/* Print the statistics at exit.  Registered with atexit () by
+   stats_init ().  */
+static void
+stats_exit (void)
+{
+  if (stats_file == NULL)
+    return;
+  stats_report (stats_file);
+  if (stats_file == stderr)
+    fflush (stderr);
+  else if (close_stream (stats_file) != 0)
+    error (0, errno, _("error writing statistics"));
+}
+
+/*-------------------------------------------------------------.
+| Print all statistics at exit to file NAME, or to stderr if   |
+| NAME is NULL.                                                |
+`-------------------------------------------------------------*/
+
+void
+stats_init (const char *name)
+{
+  if (name == NULL)
+    stats_file = stderr;
+  else
+    {
+      stats_file = fopen (name, "we");
+      if (stats_file == NULL)
+        m4_failure (errno, _("cannot open `%s'"), name);
+    }
+  if (atexit (stats_exit) != 0)
+    M4ERROR ((warning_status, 0,
+              "INTERNAL ERROR: unable to register statistics report"));
+}
+
+/*-----------------------------------------------------------------.
+| Forget the reports of --profile, --profile-stacks and --stats in |
+| a worker forked by --batch or --server, so that they are written |
+| once, by the process that set up the state, and not again by     |
+| every worker at its exit.                                        |
+`-----------------------------------------------------------------*/
+
+void
+debug_forked (void)
+{
+  profiling = false;
+  profile_file = NULL;
+  sample_file = NULL;
+  stats_file = NULL;
+}
@@ -23,6 +23,10 @@
 
 #include "m4.h"
 
+#include <stdarg.h>
+
+#include "vasnprintf.h"
+
 /* Simple varargs substitute.  We assume int and unsigned int are the
    same size; likewise for long and unsigned long.  */
 
@@ -115,25 +119,72 @@ arg_double (const char *str)
          (--argc, argv++, arg_double (TOKEN_DATA_TEXT (argv[-1]))))
 
 
-/*------------------------------------------------------------------.
-| The main formatting function.  Output is placed on the obstack    |
-| OBS, the first argument in ARGV is the formatting string, and the |
-| rest is arguments for the string.  Warn rather than invoke        |
-| unspecified behavior in the underlying printf when we do not      |
-| recognize a format.                                               |
-`------------------------------------------------------------------*/
+/* The kinds of conversions.  */
+enum format_type
+{
+  CHAR, INT, LONG, DOUBLE, STR,
+  BAD                           /* unrecognized, only warned about */
+};
 
-void
-expand_format (struct obstack *obs, int argc, token_data **argv)
+/* A conversion of a format control string.  */
+struct format_conv
+{
+  size_t text;                  /* offset in text of what comes before */
+  size_t text_len;              /* length of what comes before */
+  char spec[sizeof "%'+- 0#*.*hhd"]; /* printf format for the conversion */
+  char type;                    /* enum format_type */
+  char conv;                    /* conversion specifier */
+  bool_bitfield width_arg : 1;  /* width is taken from an argument */
+  bool_bitfield prec_arg : 1;   /* precision is taken from an argument */
+  bool_bitfield plain : 1;      /* %d, %i, %u or %s, without modifiers */
+  int width;                    /* else the minimum field width */
+  int prec;                     /* and the precision */
+};
+
+typedef struct format_conv format_conv;
+
+/* A format control string, parsed into its conversions.  */
+struct format_table
+{
+  char *control;                /* the control string */
+  size_t control_len;           /* its length */
+  char *text;                   /* text outside conversions, %% as % */
+  format_conv *convs;           /* the conversions */
+  size_t count;                 /* number of conversions */
+  size_t tail;                  /* offset in text of what comes last */
+  size_t tail_len;              /* length of what comes last */
+};
+
+typedef struct format_table format_table;
+
+/* The parsed formats of the last few distinct control strings, as a
+   code generator typically calls format with only a handful of them,
+   many times each.  */
+#define FORMAT_CACHE_SIZE 16
+
+static format_table *format_cache[FORMAT_CACHE_SIZE];
+static int format_next;                 /* next entry to replace */
+
+/*-------------------------------------------------------------------.
+| Parse the format control string F, of length LEN, into the table T |
+| of its conversions.  Which conversions are recognized does not     |
+| depend on the arguments, so this is done once per control string,  |
+| and warnings about unrecognized ones are left to each call.        |
+`-------------------------------------------------------------------*/
+
+static void
+parse_format (format_table *t, const char *f, size_t len)
 {
-  const char *f;                        /* format control string */
   const char *fmt;                      /* position within f */
-  char fstart[] = "%'+- 0#*.*hhd";      /* current format spec */
-  char *p;                              /* position within fstart */
+  char *text;                           /* position within t->text */
+  size_t start = 0;                     /* text since last conversion */
+  format_conv *conv;                    /* conversion being parsed */
+  char *p;                              /* position within conv->spec */
   unsigned char c;                      /* a simple character */
+  bool narrow;                          /* h or hh length modifier */
 
   /* Flags.  */
-  char flags;                           /* flags to use in fstart */
+  char flags;                           /* flags to use in spec */
   enum {
     THOUSANDS   = 0x01, /* ' */
     PLUS        = 0x02, /* + */
@@ -144,42 +195,48 @@ expand_format (struct obstack *obs, int argc, token_data **argv)
     DONE        = 0x40  /* no more flags */
   };
 
-  /* Precision specifiers.  */
-  int width;                    /* minimum field width */
-  int prec;                     /* precision */
-  char lflag;                   /* long flag */
-
   /* Specifiers we are willing to accept.  ok['x'] implies %x is ok.
      Various modifiers reduce the set, in order to avoid undefined
      behavior in printf.  */
   char ok[128];
 
-  /* Buffer and stuff.  */
-  char *str;                    /* malloc'd buffer of formatted text */
-  enum {CHAR, INT, LONG, DOUBLE, STR} datatype;
+  /* There are at most as many conversions as there are percents.  */
+  t->count = 0;
+  for (fmt = f; (fmt = strchr (fmt, '%')); fmt++)
+    t->count++;
+  t->convs = XNMALLOC (t->count, format_conv);
+  t->text = text = xcharalloc (len + 1);
+  t->count = 0;
 
-  f = fmt = ARG_STR (argc, argv);
+  fmt = f;
   memset (ok, 0, sizeof ok);
   while (1)
     {
       const char *percent = strchr (fmt, '%');
       if (!percent)
         {
-          obstack_grow (obs, fmt, strlen (fmt));
+          memcpy (text, fmt, strlen (fmt));
+          t->tail = start;
+          t->tail_len = text + strlen (fmt) - t->text - start;
           return;
         }
-      obstack_grow (obs, fmt, percent - fmt);
+      memcpy (text, fmt, percent - fmt);
+      text += percent - fmt;
       fmt = percent + 1;
 
       if (*fmt == '%')
         {
-          obstack_1grow (obs, '%');
+          *text++ = '%';
           fmt++;
           continue;
         }
-
-      p = fstart + 1; /* % */
-      lflag = 0;
+      conv = &t->convs[t->count++];
+      conv->text = start;
+      conv->text_len = text - t->text - start;
+      start = text - t->text;
+      p = conv->spec;
+      *p++ = '%';
+      conv->width_arg = conv->prec_arg = false;
       ok['a'] = ok['A'] = ok['c'] = ok['d'] = ok['e'] = ok['E']
         = ok['f'] = ok['F'] = ok['g'] = ok['G'] = ok['i'] = ok['o']
         = ok['s'] = ok['u'] = ok['x'] = ok['X'] = 1;
@@ -241,23 +298,23 @@ expand_format (struct obstack *obs, int argc, token_data **argv)
 
       /* Minimum field width; an explicit 0 is the same as not giving
          the width.  */
-      width = 0;
+      conv->width = 0;
       *p++ = '*';
       if (*fmt == '*')
         {
-          width = ARG_INT (argc, argv);
+          conv->width_arg = true;
           fmt++;
         }
       else
         while (c_isdigit (*fmt))
           {
-            width = 10 * width + *fmt - '0';
+            conv->width = 10 * conv->width + *fmt - '0';
             fmt++;
           }
 
       /* Maximum precision; an explicit negative precision is the same
          as not giving the precision.  A lone '.' is a precision of 0.  */
-      prec = -1;
+      conv->prec = -1;
       *p++ = '.';
       *p++ = '*';
       if (*fmt == '.')
@@ -265,70 +322,81 @@ expand_format (struct obstack *obs, int argc, token_data **argv)
           ok['c'] = 0;
           if (*(++fmt) == '*')
             {
-              prec = ARG_INT (argc, argv);
+              conv->prec_arg = true;
               ++fmt;
             }
           else
             {
-              prec = 0;
+              conv->prec = 0;
               while (c_isdigit (*fmt))
                 {
-                  prec = 10 * prec + *fmt - '0';
+                  conv->prec = 10 * conv->prec + *fmt - '0';
                   fmt++;
                 }
             }
         }
 
       /* Length modifiers.  We don't yet recognize ll, j, t, or z.  */
+      narrow = false;
       if (*fmt == 'l')
         {
           *p++ = 'l';
-          lflag = 1;
           fmt++;
           ok['c'] = ok['s'] = 0;
+          conv->type = LONG;
         }
-      else if (*fmt == 'h')
+      else
         {
-          *p++ = 'h';
-          fmt++;
           if (*fmt == 'h')
             {
               *p++ = 'h';
               fmt++;
+              if (*fmt == 'h')
+                {
+                  *p++ = 'h';
+                  fmt++;
+                }
+              ok['a'] = ok['A'] = ok['c'] = ok['e'] = ok['E'] = ok['f']
+                = ok['F'] = ok['g'] = ok['G'] = ok['s'] = 0;
+              narrow = true;
             }
-          ok['a'] = ok['A'] = ok['c'] = ok['e'] = ok['E'] = ok['f'] = ok['F']
-            = ok['g'] = ok['G'] = ok['s'] = 0;
+          conv->type = INT;
         }
 
       c = *fmt++;
+      conv->conv = c;
       if (sizeof ok <= c || !ok[c])
         {
-          M4ERROR ((warning_status, 0,
-                    _("Warning: unrecognized specifier in `%s'"), f));
+          conv->type = BAD;
           if (c == '\0')
             fmt--;
           continue;
         }
 
-      /* Specifiers.  We don't yet recognize C, S, n, or p.  */
+      /* Specifiers.  We don't yet recognize C, S, n, or p.  Without
+         width or precision, the plain ones need no printf.  */
+      conv->plain = false;
       switch (c)
         {
         case 'c':
-          datatype = CHAR;
+          conv->type = CHAR;
           p -= 2; /* %.*c is undefined, so undo the '.*'.  */
           break;
 
         case 's':
-          datatype = STR;
+          conv->type = STR;
+          conv->plain = true;
           break;
 
         case 'd':
         case 'i':
+        case 'u':
+          conv->plain = flags == DONE && !narrow;
+          break;
+
         case 'o':
         case 'x':
         case 'X':
-        case 'u':
-          datatype = lflag ? LONG : INT;
           break;
 
         case 'a':
@@ -339,7 +407,7 @@ expand_format (struct obstack *obs, int argc, token_data **argv)
         case 'F':
         case 'g':
         case 'G':
-          datatype = DOUBLE;
+          conv->type = DOUBLE;
           break;
 
         default:
@@ -347,48 +415,191 @@ expand_format (struct obstack *obs, int argc, token_data **argv)
         }
       *p++ = c;
       *p = '\0';
+    }
+}
+
+/*------------------------------------------------------------------.
+| Return the parsed format control string F, from the cache, or     |
+| parsed and cached.                                                |
+`------------------------------------------------------------------*/
+
+static const format_table *
+format_lookup (const char *f)
+{
+  size_t len = strlen (f);
+  format_table *t;
+  int i;
 
-      /* Our constructed format string in fstart is safe.  */
+  for (i = 0; i < FORMAT_CACHE_SIZE; i++)
+    {
+      t = format_cache[i];
+      if (t && t->control_len == len && memcmp (t->control, f, len) == 0)
+        return t;
+    }
+
+  t = format_cache[format_next];
+  if (t)
+    {
+      free (t->control);
+      free (t->text);
+      free (t->convs);
+    }
+  else
+    t = format_cache[format_next] = XMALLOC (format_table);
+  format_next = (format_next + 1) % FORMAT_CACHE_SIZE;
+  t->control = xmemdup (f, len + 1);
+  t->control_len = len;
+  parse_format (t, f, len);
+  return t;
+}
+
+/*-------------------------------------------------------------------.
+| Format the arguments after SPEC with printf, straight into the     |
+| free room of the obstack OBS, and grow it by the result.  Only if  |
+| the result does not fit in that room is it allocated, as a larger  |
+| chunk would be anyway.  If NUL_ENDS, the result ends at its first  |
+| NUL, as only %c can produce.                                       |
+`-------------------------------------------------------------------*/
+
+/* Our constructed format strings are safe.  */
 #if 4 < __GNUC__ + (6 <= __GNUC_MINOR__)
 # pragma GCC diagnostic push
 # pragma GCC diagnostic ignored "-Wformat-nonliteral"
 #endif
 
-      switch (datatype)
+static void
+grow_formatted (struct obstack *obs, bool nul_ends, const char *spec, ...)
+{
+  va_list args;
+  size_t len;
+  char *str;
+
+  obstack_make_room (obs, 64);
+  len = obstack_room (obs);
+  va_start (args, spec);
+  str = vasnprintf (obstack_next_free (obs), &len, spec, args);
+  va_end (args);
+
+  /* NULL is returned on failure, such as invalid format string.  For
+     now, just silently ignore that bad specifier.  */
+  if (str == NULL)
+    {
+      if (errno == ENOMEM)
+        xalloc_die ();
+      return;
+    }
+
+  if (nul_ends)
+    len = strlen (str);
+  if (str == obstack_next_free (obs))
+    obstack_blank_fast (obs, len);
+  else
+    {
+      obstack_grow (obs, str, len);
+      free (str);
+    }
+}
+
+#if 4 < __GNUC__ + (6 <= __GNUC_MINOR__)
+# pragma GCC diagnostic pop
+#endif
+
+/*------------------------------------------------------------------.
+| Grow the obstack OBS by the decimal digits of VALUE, after a      |
+| minus sign if NEGATIVE.  This is what %d, %i and %u print without |
+| flags, width or precision.                                        |
+`------------------------------------------------------------------*/
+
+static void
+grow_decimal (struct obstack *obs, unsigned long value, bool negative)
+{
+  char buf[INT_BUFSIZE_BOUND (unsigned long) + 1];
+  char *s = buf + sizeof buf;
+
+  do
+    *--s = '0' + value % 10;
+  while ((value /= 10) != 0);
+  if (negative)
+    *--s = '-';
+  obstack_grow (obs, s, buf + sizeof buf - s);
+}
+
+/*------------------------------------------------------------------.
+| The main formatting function.  Output is placed on the obstack    |
+| OBS, the first argument in ARGV is the formatting string, and the |
+| rest is arguments for the string.  Warn rather than invoke        |
+| unspecified behavior in the underlying printf when we do not      |
+| recognize a format.  The control string is parsed once, and plain |
+| integer and string conversions are copied without printf.         |
+`------------------------------------------------------------------*/
+
+void
+expand_format (struct obstack *obs, int argc, token_data **argv)
+{
+  const char *f;                        /* format control string */
+  const format_table *t;                /* its conversions */
+  const format_conv *conv;              /* the current one */
+  size_t i;
+  int width;                    /* minimum field width */
+  int prec;                     /* precision */
+  long value;                   /* integer argument */
+  const char *str;              /* string argument */
+
+  f = ARG_STR (argc, argv);
+  t = format_lookup (f);
+
+  for (i = 0; i < t->count; i++)
+    {
+      conv = &t->convs[i];
+      obstack_grow (obs, t->text + conv->text, conv->text_len);
+      width = conv->width_arg ? ARG_INT (argc, argv) : conv->width;
+      prec = conv->prec_arg ? ARG_INT (argc, argv) : conv->prec;
+
+      switch (conv->type)
         {
-        case CHAR:
-          str = xasprintf (fstart, width, ARG_INT(argc, argv));
+        case BAD:
+          M4ERROR ((warning_status, 0,
+                    _("Warning: unrecognized specifier in `%s'"), f));
           break;
 
-        case INT:
-          str = xasprintf (fstart, width, prec, ARG_INT(argc, argv));
+        case CHAR:
+          grow_formatted (obs, true, conv->spec, width, ARG_INT (argc, argv));
           break;
 
+        case INT:
         case LONG:
-          str = xasprintf (fstart, width, prec, ARG_LONG(argc, argv));
+          if (conv->type == LONG)
+            value = ARG_LONG (argc, argv);
+          else
+            value = ARG_INT (argc, argv);
+          if (conv->plain && !width && prec < 0 && conv->conv == 'u')
+            grow_decimal (obs, (conv->type == LONG ? (unsigned long) value
+                                : (unsigned int) value), false);
+          else if (conv->plain && !width && prec < 0)
+            grow_decimal (obs, (value < 0 ? - (unsigned long) value
+                                : (unsigned long) value), value < 0);
+          else if (conv->type == LONG)
+            grow_formatted (obs, false, conv->spec, width, prec, value);
+          else
+            grow_formatted (obs, false, conv->spec, width, prec, (int) value);
           break;
 
         case DOUBLE:
-          str = xasprintf (fstart, width, prec, ARG_DOUBLE(argc, argv));
+          grow_formatted (obs, false, conv->spec, width, prec,
+                          ARG_DOUBLE (argc, argv));
           break;
 
         case STR:
-          str = xasprintf (fstart, width, prec, ARG_STR(argc, argv));
+          str = ARG_STR (argc, argv);
+          if (conv->plain && !width && prec < 0)
+            obstack_grow (obs, str, strlen (str));
+          else
+            grow_formatted (obs, false, conv->spec, width, prec, str);
           break;
 
         default:
-          abort();
+          abort ();
         }
-#if 4 < __GNUC__ + (6 <= __GNUC_MINOR__)
-# pragma GCC diagnostic pop
-#endif
-
-      /* NULL was returned on failure, such as invalid format string.  For
-         now, just silently ignore that bad specifier.  */
-      if (str == NULL)
-        continue;
-
-      obstack_grow (obs, str, strlen (str));
-      free (str);
     }
+  obstack_grow (obs, t->text + t->tail, t->tail_len);
 }
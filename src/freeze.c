@@ -23,6 +23,10 @@
 
 #include "m4.h"
 
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
 /*-------------------------------------------------------------------.
 | Destructively reverse a symbol list and return the reversed list.  |
 `-------------------------------------------------------------------*/
@@ -101,12 +105,197 @@ INTERNAL ERROR: bad token data type in freeze_symbol ()"));
   reverse_symbol_list (s);
 }
 
-/*------------------------------------------------.
-| Produce a frozen state to the given file NAME.  |
-`------------------------------------------------*/
+/* Version 2 of the frozen file format is binary.  After the `V2'
+   line, it holds a header of eight 4-byte numbers (the width in bits
+   of hash values, the hash table size, the length of the string
+   table, the number of symbol records, and the offsets of the quote
+   and comment delimiters in the string table), the string table of
+   NUL-terminated strings, then one 24-byte record per definition, in
+   the order of the hash table: offset of the name, offset and length
+   of the text, flags, and the 8-byte hash value of the name.  The
+   diversions follow: their count, each one as its number, an 8-byte
+   length and the contents, then the number of the current diversion.
+   All numbers are little endian.  */
+
+#define FROZEN_RECORD_SIZE 24
+
+/* Flags of a symbol record.  */
+#define FROZEN_BUILTIN 1        /* text is the name of a builtin */
+#define FROZEN_STACKED 2        /* pushed below the previous record */
+
+typedef struct frozen_record frozen_record;
+typedef struct frozen_table frozen_table;
+
+struct frozen_record
+{
+  size_t name;                  /* offset of the name */
+  size_t text;                  /* offset of the text */
+  size_t length;                /* length of the text */
+  unsigned int flags;           /* FROZEN_BUILTIN, FROZEN_STACKED */
+  size_t hash;                  /* hash value of the name */
+};
+
+struct frozen_table
+{
+  struct obstack strings;       /* string table being built */
+  frozen_record *records;       /* symbol records, in hash table order */
+  size_t count;                 /* number of records used */
+  size_t allocated;             /* number of records allocated */
+};
+
+/*-----------------------------------------------------------------.
+| Write NUMBER on FILE, in BYTES bytes with the least significant  |
+| first.  This is the encoding of all numbers in a version 2       |
+| frozen file.                                                     |
+`-----------------------------------------------------------------*/
+
+void
+freeze_put_number (FILE *file, uintmax_t number, int bytes)
+{
+  while (bytes-- > 0)
+    {
+      putc (number & 0xff, file);
+      number >>= 8;
+    }
+}
+
+/*----------------------------------------------------------------.
+| Add STRING, of LENGTH bytes, to the string table of TABLE, and  |
+| return its offset.                                              |
+`----------------------------------------------------------------*/
+
+static size_t
+freeze_string (frozen_table *table, const char *string, size_t length)
+{
+  size_t offset = obstack_object_size (&table->strings);
+
+  obstack_grow0 (&table->strings, string, length);
+  return offset;
+}
+
+/*-----------------------------------------------------------------.
+| Add records for the whole definition stack of SYM to the table   |
+| ARG, from the current definition down to the oldest one.         |
+`-----------------------------------------------------------------*/
+
+static void
+collect_symbol (symbol *sym, void *arg)
+{
+  frozen_table *table = arg;
+  frozen_record *record;
+  const builtin *bp;
+  const char *text;
+  unsigned int flags = 0;
+  size_t name = 0;
+
+  for (; sym; sym = SYMBOL_STACK (sym))
+    {
+      switch (SYMBOL_TYPE (sym))
+        {
+        case TOKEN_TEXT:
+          text = SYMBOL_TEXT (sym);
+          flags &= ~FROZEN_BUILTIN;
+          break;
+
+        case TOKEN_FUNC:
+          bp = find_builtin_by_addr (SYMBOL_FUNC (sym));
+          if (bp == NULL)
+            {
+              M4ERROR ((warning_status, 0, "\
+INTERNAL ERROR: builtin not found in builtin table!"));
+              abort ();
+            }
+          text = bp->name;
+          flags |= FROZEN_BUILTIN;
+          break;
+
+        case TOKEN_VOID:
+          /* Ignore placeholder tokens that exist due to traceon.  */
+          continue;
+
+        default:
+          M4ERROR ((warning_status, 0, "\
+INTERNAL ERROR: bad token data type in collect_symbol ()"));
+          abort ();
+        }
+
+      if (table->count == table->allocated)
+        table->records = x2nrealloc (table->records, &table->allocated,
+                                     sizeof *table->records);
+      record = &table->records[table->count++];
+
+      /* All definitions of a name share its first copy.  */
+      if (!(flags & FROZEN_STACKED))
+        name = freeze_string (table, SYMBOL_NAME (sym),
+                              strlen (SYMBOL_NAME (sym)));
+      record->name = name;
+      record->length = strlen (text);
+      record->text = freeze_string (table, text, record->length);
+      record->flags = flags;
+      record->hash = sym->hash;
+      flags |= FROZEN_STACKED;
+    }
+}
+
+/*-----------------------------------------------------------.
+| Write the symbol table to FILE, in version 2 format.       |
+`-----------------------------------------------------------*/
+
+static void
+freeze_symbol_table (FILE *file)
+{
+  frozen_table table;
+  frozen_record *record;
+  size_t delimiters[4];
+  size_t length;
+  char *strings;
+  size_t i;
+
+  obstack_init (&table.strings);
+  table.records = NULL;
+  table.count = table.allocated = 0;
+
+  delimiters[0] = freeze_string (&table, lquote.string, lquote.length);
+  delimiters[1] = freeze_string (&table, rquote.string, rquote.length);
+  delimiters[2] = freeze_string (&table, bcomm.string, bcomm.length);
+  delimiters[3] = freeze_string (&table, ecomm.string, ecomm.length);
+  hack_all_symbols (collect_symbol, &table);
+
+  length = obstack_object_size (&table.strings);
+  strings = (char *) obstack_finish (&table.strings);
+  if (length > UINT32_MAX || table.count > UINT32_MAX)
+    m4_failure (0, _("frozen state too large for format 2"));
+
+  freeze_put_number (file, sizeof (size_t) * CHAR_BIT, 4);
+  freeze_put_number (file, hash_table_size <= UINT32_MAX
+                     ? hash_table_size : 0, 4);
+  freeze_put_number (file, length, 4);
+  freeze_put_number (file, table.count, 4);
+  for (i = 0; i < 4; i++)
+    freeze_put_number (file, delimiters[i], 4);
+  fwrite (strings, 1, length, file);
+
+  for (record = table.records; record < table.records + table.count;
+       record++)
+    {
+      freeze_put_number (file, record->name, 4);
+      freeze_put_number (file, record->text, 4);
+      freeze_put_number (file, record->length, 4);
+      freeze_put_number (file, record->flags, 4);
+      freeze_put_number (file, record->hash, 8);
+    }
+
+  obstack_free (&table.strings, NULL);
+  free (table.records);
+}
+
+/*-------------------------------------------------------------.
+| Produce a frozen state to the given file NAME, using format  |
+| VERSION.                                                     |
+`-------------------------------------------------------------*/
 
 void
-produce_frozen_state (const char *name)
+produce_frozen_state (const char *name, int version)
 {
   FILE *file;
 
@@ -118,36 +307,45 @@ produce_frozen_state (const char *name)
 
   xfprintf (file, "# This is a frozen state file generated by %s\n",
            PACKAGE_STRING);
-  xfprintf (file, "V1\n");
+  xfprintf (file, "V%d\n", version);
 
-  /* Dump quote delimiters.  */
-
-  if (strcmp (lquote.string, DEF_LQUOTE) || strcmp (rquote.string, DEF_RQUOTE))
+  if (version > 1)
+    freeze_symbol_table (file);
+  else
     {
-      xfprintf (file, "Q%d,%d\n", (int) lquote.length, (int) rquote.length);
-      fputs (lquote.string, file);
-      fputs (rquote.string, file);
-      fputc ('\n', file);
-    }
+      /* Dump quote delimiters.  */
+
+      if (strcmp (lquote.string, DEF_LQUOTE)
+          || strcmp (rquote.string, DEF_RQUOTE))
+        {
+          xfprintf (file, "Q%d,%d\n", (int) lquote.length,
+                    (int) rquote.length);
+          fputs (lquote.string, file);
+          fputs (rquote.string, file);
+          fputc ('\n', file);
+        }
 
-  /* Dump comment delimiters.  */
+      /* Dump comment delimiters.  */
 
-  if (strcmp (bcomm.string, DEF_BCOMM) || strcmp (ecomm.string, DEF_ECOMM))
-    {
-      xfprintf (file, "C%d,%d\n", (int) bcomm.length, (int) ecomm.length);
-      fputs (bcomm.string, file);
-      fputs (ecomm.string, file);
-      fputc ('\n', file);
-    }
+      if (strcmp (bcomm.string, DEF_BCOMM)
+          || strcmp (ecomm.string, DEF_ECOMM))
+        {
+          xfprintf (file, "C%d,%d\n", (int) bcomm.length,
+                    (int) ecomm.length);
+          fputs (bcomm.string, file);
+          fputs (ecomm.string, file);
+          fputc ('\n', file);
+        }
 
-  /* Dump all symbols.  */
+      /* Dump all symbols.  */
 
-  hack_all_symbols (freeze_symbol, file);
+      hack_all_symbols (freeze_symbol, file);
+    }
 
   /* Let diversions be issued from output.c module, its cleaner to have this
      piece of code there.  */
 
-  freeze_diversions (file);
+  freeze_diversions (file, version);
 
   /* All done.  */
 
@@ -169,20 +367,276 @@ issue_expect_message (int expected)
     m4_failure (0, _("expecting character `%c' in frozen file"), expected);
 }
 
+/*-------------------------------------------------------------------.
+| Read all of the frozen FILE into writable memory, and store its    |
+| length in *LENGTH.  The memory is never released, since reloaded   |
+| macro definitions point into it.  The file is mapped if possible,  |
+| to avoid copying it.                                               |
+`-------------------------------------------------------------------*/
+
+static char *
+load_frozen_file (FILE *file, size_t *length)
+{
+  char *buffer;
+  size_t allocated;
+  size_t used;
+
+#if HAVE_MMAP
+  struct stat file_stat;
+
+  if (fstat (fileno (file), &file_stat) == 0
+      && S_ISREG (file_stat.st_mode) && 0 < file_stat.st_size
+      && file_stat.st_size + 0UL == (unsigned long int) file_stat.st_size)
+    {
+      buffer = mmap (NULL, file_stat.st_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fileno (file), 0);
+      if (buffer != MAP_FAILED)
+        {
+          *length = file_stat.st_size;
+          return buffer;
+        }
+    }
+#endif /* HAVE_MMAP */
+
+  allocated = 8 * 1024;
+  buffer = xcharalloc (allocated);
+  used = 0;
+  while ((used += fread (buffer + used, 1, allocated - used, file))
+         == allocated)
+    buffer = x2realloc (buffer, &allocated);
+  if (ferror (file))
+    m4_failure (errno, _("unable to read frozen state"));
+  *length = used;
+  return buffer;
+}
+
+/*------------------------------------------------------------------.
+| Return the number stored in BYTES bytes at *CURSOR, least         |
+| significant first, and advance *CURSOR past it, but not past END. |
+`------------------------------------------------------------------*/
+
+static uintmax_t
+get_number (char **cursor, const char *end, int bytes)
+{
+  uintmax_t number = 0;
+  int i;
+
+  if (end - *cursor < bytes)
+    m4_failure (0, _("premature end of frozen file"));
+  for (i = bytes; i-- > 0; )
+    number = (number << 8) | to_uchar ((*cursor)[i]);
+  *cursor += bytes;
+  return number;
+}
+
+/*------------------------------------------------------------------.
+| Decode record INDEX of RECORDS into *RECORD, checking that its    |
+| strings lie within the string table of LENGTH bytes.              |
+`------------------------------------------------------------------*/
+
+static void
+get_record (char *records, size_t index, const char *strings,
+            size_t length, frozen_record *record)
+{
+  char *cursor = records + index * FROZEN_RECORD_SIZE;
+  const char *end = cursor + FROZEN_RECORD_SIZE;
+
+  record->name = get_number (&cursor, end, 4);
+  record->text = get_number (&cursor, end, 4);
+  record->length = get_number (&cursor, end, 4);
+  record->flags = get_number (&cursor, end, 4);
+  record->hash = get_number (&cursor, end, 8);
+  if (length <= record->name || length <= record->text
+      || length - record->text <= record->length
+      || strings[record->text + record->length] != '\0'
+      || (record->flags & ~(FROZEN_BUILTIN | FROZEN_STACKED))
+      || (index == 0 && (record->flags & FROZEN_STACKED)))
+    m4_failure (0, _("ill-formed frozen file"));
+}
+
+/*------------------------------------------------------------------.
+| Define the symbol SYM as described by RECORD, whose strings are   |
+| in STRINGS.                                                       |
+`------------------------------------------------------------------*/
+
+static void
+define_frozen_symbol (symbol *sym, const frozen_record *record,
+                      char *strings)
+{
+  if (record->flags & FROZEN_BUILTIN)
+    set_builtin_definition (sym, find_builtin_by_name (strings
+                                                       + record->text));
+  else
+    set_mapped_definition (sym, strings + record->text);
+}
+
+/*-------------------------------------------------------------------.
+| Reload the body of a version 2 frozen file, from CURSOR up to END. |
+| When the file was produced with the same hash table size, width    |
+| and function of hash values, each bucket chain is built directly   |
+| from the records, which are in hash table order, and installed     |
+| whole; otherwise each definition is entered with lookup_symbol (). |
+`-------------------------------------------------------------------*/
+
+static void
+reload_frozen_v2 (char *cursor, char *end)
+{
+  size_t delimiters[4];
+  frozen_record record;
+  char *strings;
+  char *records;
+  size_t length;
+  size_t count;
+  size_t i, j;
+  bool bulk;
+  symbol *chain = NULL;         /* chain of the current bucket */
+  symbol *top = NULL;           /* last symbol of that chain */
+  symbol *sym;
+  size_t bucket = 0;
+  uintmax_t diversions;
+
+  bulk = get_number (&cursor, end, 4) == sizeof (size_t) * CHAR_BIT;
+  bulk &= get_number (&cursor, end, 4) == hash_table_size;
+  length = get_number (&cursor, end, 4);
+  count = get_number (&cursor, end, 4);
+  for (i = 0; i < 4; i++)
+    delimiters[i] = get_number (&cursor, end, 4);
+
+  if ((size_t) (end - cursor) < length
+      || (size_t) (end - cursor - length) / FROZEN_RECORD_SIZE < count)
+    m4_failure (0, _("premature end of frozen file"));
+  strings = cursor;
+  records = cursor + length;
+  cursor = records + count * FROZEN_RECORD_SIZE;
+  if (length == 0 || strings[length - 1] != '\0')
+    m4_failure (0, _("ill-formed frozen file"));
+  for (i = 0; i < 4; i++)
+    if (length <= delimiters[i])
+      m4_failure (0, _("ill-formed frozen file"));
+
+  /* A file written with another hash function has the right table
+     size, but hash values that would misplace the symbols.  */
+  for (i = 0; bulk && i < count; i++)
+    {
+      get_record (records, i, strings, length, &record);
+      bulk = record.hash == symbol_hash (strings + record.name);
+    }
+
+  if (strcmp (strings + delimiters[0], DEF_LQUOTE)
+      || strcmp (strings + delimiters[1], DEF_RQUOTE))
+    set_quotes (strings + delimiters[0], strings + delimiters[1]);
+  if (strcmp (strings + delimiters[2], DEF_BCOMM)
+      || strcmp (strings + delimiters[3], DEF_ECOMM))
+    set_comment (strings + delimiters[2], strings + delimiters[3]);
+
+  for (i = 0; i < count; i = j)
+    {
+      /* Records I to J - 1 are one definition stack, newest first.  */
+      for (j = i + 1; j < count; j++)
+        {
+          get_record (records, j, strings, length, &record);
+          if (!(record.flags & FROZEN_STACKED))
+            break;
+        }
+      get_record (records, i, strings, length, &record);
+
+      if (!bulk)
+        {
+          /* Push the definitions, oldest first.  */
+          size_t k = j;
+          while (k-- > i)
+            {
+              get_record (records, k, strings, length, &record);
+              if (record.flags & FROZEN_BUILTIN)
+                define_builtin (strings + record.name,
+                                find_builtin_by_name (strings + record.text),
+                                SYMBOL_PUSHDEF);
+              else
+                define_mapped_macro (strings + record.name,
+                                     strings + record.text, SYMBOL_PUSHDEF);
+            }
+          continue;
+        }
+
+      /* Buckets must come in order, and the names within a bucket
+         must be ordered as lookup_symbol () keeps them: by decreasing
+         hash value, then alphabetically.  */
+      if (record.hash % hash_table_size != bucket || chain == NULL)
+        {
+          if (record.hash % hash_table_size < bucket)
+            m4_failure (0, _("ill-formed frozen file"));
+          if (chain != NULL)
+            install_symbol_chain (bucket, chain);
+          bucket = record.hash % hash_table_size;
+          chain = top = NULL;
+        }
+      else if (record.hash > top->hash
+               || (record.hash == top->hash
+                   && strcmp (SYMBOL_NAME (top), strings + record.name) >= 0))
+        m4_failure (0, _("ill-formed frozen file"));
+
+      sym = new_symbol (xstrdup (strings + record.name), record.hash);
+      define_frozen_symbol (sym, &record, strings);
+      if (top == NULL)
+        chain = sym;
+      else
+        top->next = sym;
+      top = sym;
+
+      /* The older definitions share the name of the newest one.  */
+      while (++i < j)
+        {
+          get_record (records, i, strings, length, &record);
+          SYMBOL_STACK (sym) = new_symbol (SYMBOL_NAME (top), top->hash);
+          sym = SYMBOL_STACK (sym);
+          define_frozen_symbol (sym, &record, strings);
+        }
+    }
+  if (chain != NULL)
+    install_symbol_chain (bucket, chain);
+
+  /* Reload the diversions, and select the current one.  */
+
+  diversions = get_number (&cursor, end, 4);
+  while (diversions-- > 0)
+    {
+      make_diversion ((int32_t) get_number (&cursor, end, 4));
+      length = get_number (&cursor, end, 8);
+      if ((size_t) (end - cursor) < length)
+        m4_failure (0, _("premature end of frozen file"));
+      while (length > 0)
+        {
+          int chunk = length < INT_MAX ? length : INT_MAX;
+          output_text (cursor, chunk);
+          cursor += chunk;
+          length -= chunk;
+        }
+    }
+  make_diversion ((int32_t) get_number (&cursor, end, 4));
+
+  /* Only the trailing comment may follow.  */
+  if (cursor < end && *cursor != '#')
+    m4_failure (0, _("ill-formed frozen file"));
+}
+
 /*-------------------------------------------------.
 | Reload a frozen state from the given file NAME.  |
 `-------------------------------------------------*/
 
-/* We are seeking speed, here.  */
+/* We are seeking speed, here.  The whole file is brought into memory
+   first, and strings are used in place: macro definitions are never
+   copied unless they are redefined.  */
 
 void
 reload_frozen_state (const char *name)
 {
   FILE *file;
+  char *cursor;
+  char *end;
+  size_t length;
   int character;
   int operation;
   char *string[2];
-  int allocated[2];
   int number[2];
   const builtin *bp;
   bool advance_line = true;
@@ -195,7 +649,7 @@ reload_frozen_state (const char *name)
           current_line++;                                       \
           advance_line = false;                                 \
         }                                                       \
-      (character = getc (file));                                \
+      character = cursor < end ? to_uchar (*cursor++) : EOF;    \
       if (character == '\n')                                    \
         advance_line = true;                                    \
     }                                                           \
@@ -241,23 +695,19 @@ reload_frozen_state (const char *name)
     }                                                           \
   while (character == '\n')
 
+  /* Point string[I] at the next number[I] bytes, without copying
+     them.  They are not NUL-terminated yet.  */
+
 #define GET_STRING(i)                                                   \
   do                                                                    \
     {                                                                   \
       void *tmp;                                                        \
       char *p;                                                          \
-      if (number[(i)] + 1 > allocated[(i)])                             \
-        {                                                               \
-          free (string[(i)]);                                           \
-          allocated[(i)] = number[(i)] + 1;                             \
-          string[(i)] = xcharalloc ((size_t) allocated[(i)]);           \
-        }                                                               \
-      if (number[(i)] > 0                                               \
-          && !fread (string[(i)], (size_t) number[(i)], 1, file))       \
+      if (end - cursor < number[(i)])                                   \
         m4_failure (0, _("premature end of frozen file"));              \
-      string[(i)][number[(i)]] = '\0';                                  \
-      p = string[(i)];                                                  \
-      while ((tmp = memchr(p, '\n', number[(i)] - (p - string[(i)]))))  \
+      string[(i)] = p = cursor;                                         \
+      cursor += number[(i)];                                            \
+      while ((tmp = memchr (p, '\n', cursor - p)))                      \
         {                                                               \
           current_line++;                                               \
           p = (char *) tmp + 1;                                         \
@@ -270,25 +720,33 @@ reload_frozen_state (const char *name)
     m4_failure (errno, _("cannot open %s"), name);
   current_file = name;
 
-  allocated[0] = 100;
-  string[0] = xcharalloc ((size_t) allocated[0]);
-  allocated[1] = 100;
-  string[1] = xcharalloc ((size_t) allocated[1]);
+  string[0] = string[1] = NULL;
+  cursor = load_frozen_file (file, &length);
+  end = cursor + length;
+  if (close_stream (file) != 0)
+    m4_failure (errno, _("unable to read frozen state"));
 
-  /* Validate format version.  Only `1' is acceptable for now.  */
+  /* Validate format version.  Only `1' and `2' are acceptable.  */
   GET_DIRECTIVE;
   VALIDATE ('V');
   GET_CHARACTER;
   GET_NUMBER (number[0], false);
-  if (number[0] > 1)
+  if (number[0] > 2)
     M4ERROR ((EXIT_MISMATCH, 0,
-              _("frozen file version %d greater than max supported of 1"),
+              _("frozen file version %d greater than max supported of 2"),
               number[0]));
   else if (number[0] < 1)
     m4_failure (0, _("ill-formed frozen file, version directive expected"));
   VALIDATE ('\n');
 
-  GET_DIRECTIVE;
+  /* The rest of a version 2 file is binary.  */
+  if (number[0] == 2)
+    {
+      reload_frozen_v2 (cursor, end);
+      character = EOF;
+    }
+  else
+    GET_DIRECTIVE;
   while (character != EOF)
     {
       switch (character)
@@ -325,6 +783,18 @@ reload_frozen_state (const char *name)
           GET_CHARACTER;
           VALIDATE ('\n');
 
+          /* Terminate both strings in place.  The second one ends
+             where the newline just read was; the first one is moved
+             back over the newline that ended the directive.  */
+
+          cursor[-1] = '\0';
+          if (operation != 'D')
+            {
+              memmove (string[0] - 1, string[0], number[0]);
+              string[0]--;
+              string[0][number[0]] = '\0';
+            }
+
           /* Act according to operation letter.  */
 
           switch (operation)
@@ -357,7 +827,7 @@ reload_frozen_state (const char *name)
 
               /* Enter a macro having an expansion text as a definition.  */
 
-              define_user_macro (string[0], string[1], SYMBOL_PUSHDEF);
+              define_mapped_macro (string[0], string[1], SYMBOL_PUSHDEF);
               break;
 
             case 'Q':
@@ -379,10 +849,6 @@ reload_frozen_state (const char *name)
       GET_DIRECTIVE;
     }
 
-  free (string[0]);
-  free (string[1]);
-  if (close_stream (file) != 0)
-    m4_failure (errno, _("unable to read frozen state"));
   current_file = NULL;
   current_line = 0;
 
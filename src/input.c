@@ -85,11 +85,18 @@ struct input_block
         {
           char *string;         /* remaining string value */
           char *end;            /* terminating NUL of string */
+          char *start;          /* where each repetition starts */
+          size_t repeat;        /* repetitions left after this one */
+          loop_func *loop;      /* if a loop, called between passes */
+          void *loop_data;      /* argument to loop */
         }
         u_s;    /* INPUT_STRING */
       struct
         {
-          FILE *fp;                  /* input file handle */
+          FILE *fp;                  /* input file handle, or NULL */
+          cached_file *cached;       /* else cached contents read */
+          const char *text;          /* remaining cached contents */
+          const char *end_text;      /* end of cached contents */
           bool_bitfield end : 1;     /* true if peek has seen EOF */
           bool_bitfield close : 1;   /* true if we should close file on pop */
           bool_bitfield advance : 1; /* track previous start_of_input_line */
@@ -139,8 +146,16 @@ static bool start_of_input_line;
 /* Flag for next_char () to recognize change in input block.  */
 static bool input_change;
 
+/* Number of macro arguments handed out by quoted_argument () that are
+   still in use.  They point into string blocks, so while there are
+   any, no block is released: exhausted blocks are only unlinked from
+   the input stack, and their memory goes when a block below them is
+   released.  */
+static int quoted_arguments;
+
 #define CHAR_EOF        256     /* character return on EOF */
 #define CHAR_MACRO      257     /* character return for MACRO token */
+#define CHAR_LOOP       258     /* character return at end of loop pass */
 
 /* Quote chars.  */
 STRING rquote;
@@ -200,6 +215,7 @@ push_file (FILE *fp, const char *title, bool close_when_done)
   input_change = true;
 
   i->u.u_f.fp = fp;
+  i->u.u_f.cached = NULL;
   i->u.u_f.end = false;
   i->u.u_f.close = close_when_done;
   i->u.u_f.advance = start_of_input_line;
@@ -209,6 +225,23 @@ push_file (FILE *fp, const char *title, bool close_when_done)
   isp = i;
 }
 
+/*------------------------------------------------------------------.
+| push_cached_file () is push_file () for the contents CACHED of an |
+| included file, which are read in place.  The input releases       |
+| CACHED when done with it.                                         |
+`------------------------------------------------------------------*/
+
+void
+push_cached_file (cached_file *cached, const char *title)
+{
+  size_t len;
+
+  push_file (NULL, title, false);
+  isp->u.u_f.cached = cached;
+  isp->u.u_f.text = cached_file_text (cached, &len);
+  isp->u.u_f.end_text = isp->u.u_f.text + len;
+}
+
 /*---------------------------------------------------------------.
 | push_macro () pushes a builtin macro's definition on the input |
 | stack.  If next is non-NULL, this push invalidates a call to   |
@@ -253,14 +286,45 @@ push_string_init (void)
       abort ();
     }
 
-  /* Prefer reusing an older block, for tail-call optimization.  */
-  while (isp && isp->type == INPUT_STRING && !isp->u.u_s.string[0])
+  /* Prefer reusing an older block, for tail-call optimization.  Not
+     while quoted arguments are in use, as the block would then only
+     be unlinked and stay in memory below the new one.  */
+  while (!quoted_arguments && isp && isp->type == INPUT_STRING
+         && !isp->u.u_s.string[0] && !isp->u.u_s.repeat && !isp->u.u_s.loop)
     pop_input ();
+
+  /* A recursive macro whose expansion ends in a call followed by a
+     little more text, such as `' or dnl, leaves that text pending at
+     each level.  When it is the same as the text pending just below,
+     count one more repetition of the latter instead, so that the
+     input stack stays bounded.  */
+  if (!quoted_arguments && isp && isp->type == INPUT_STRING
+      && !isp->u.u_s.repeat && !isp->u.u_s.loop
+      && isp->prev && isp->prev->type == INPUT_STRING
+      && !isp->prev->u.u_s.loop
+      && isp->file == isp->prev->file && isp->line == isp->prev->line)
+    {
+      input_block *below = isp->prev;
+      size_t len = isp->u.u_s.end - isp->u.u_s.string;
+
+      if ((!below->u.u_s.repeat || below->u.u_s.string == below->u.u_s.start)
+          && (size_t) (below->u.u_s.end - below->u.u_s.string) == len
+          && memcmp (isp->u.u_s.string, below->u.u_s.string, len) == 0)
+        {
+          if (!below->u.u_s.repeat)
+            below->u.u_s.start = below->u.u_s.string;
+          below->u.u_s.repeat++;
+          pop_input ();
+        }
+    }
+
   next = (input_block *) obstack_alloc (current_input,
                                         sizeof (struct input_block));
   next->type = INPUT_STRING;
   next->file = current_file;
   next->line = current_line;
+  next->u.u_s.repeat = 0;
+  next->u.u_s.loop = NULL;
 
   return current_input;
 }
@@ -289,17 +353,102 @@ push_string_finish (void)
       obstack_1grow (current_input, '\0');
       next->u.u_s.string = (char *) obstack_finish (current_input);
       next->u.u_s.end = next->u.u_s.string + len;
+      next->u.u_s.start = next->u.u_s.string;
       next->prev = isp;
       isp = next;
       ret = isp->u.u_s.string; /* for immediate use only */
       input_change = true;
+      stats.pushed_strings++;
+      stats.pushed_bytes += len;
     }
   else
-    obstack_free (current_input, next); /* people might leave garbage on it. */
+    {
+      if (next->u.u_s.loop)
+        next->u.u_s.loop (next->u.u_s.loop_data, true);
+      /* people might leave garbage on it. */
+      obstack_free (current_input, next);
+    }
   next = NULL;
   return ret;
 }
 
+/*-------------------------------------------------------------------.
+| Make the text collected since push_string_init () a loop: once     |
+| pushed by push_string_finish (), it is read COUNT times over, and  |
+| FUNC is called with DATA and false between passes, so that it can  |
+| change what the text expands to on the next pass, and with DATA    |
+| and true when the loop is done, or if nothing gets pushed.  The    |
+| end of each pass ends any token, as a quoted empty string would.   |
+`-------------------------------------------------------------------*/
+
+void
+push_string_loop (size_t count, loop_func *func, void *data)
+{
+  if (next == NULL || count == 0)
+    {
+      func (data, true);
+      return;
+    }
+  next->u.u_s.repeat = count - 1;
+  next->u.u_s.loop = func;
+  next->u.u_s.loop_data = data;
+}
+
+/*-------------------------------------------------------------------.
+| Alternative to push_string_finish () for an expansion that might   |
+| be inert.  If the text collected since push_string_init () is not  |
+| empty, and rescanning it could only copy it to the output, return  |
+| it without pushing it; the caller then ships it itself and calls   |
+| push_string_discard ().  That is the case if it holds no word, and |
+| nothing that starts a quoted string or a comment, and, if it is to |
+| become part of a macro argument (IN_ARGUMENT), no parenthesis or   |
+| comma.  With -s, newlines are excluded too, as rescanning them     |
+| affects the synchronization lines.  Otherwise, return NULL, and    |
+| leave the text in place for push_string_finish ().                 |
+`-------------------------------------------------------------------*/
+
+const char *
+push_string_inert (bool in_argument)
+{
+  const char *text;
+  size_t len;
+  size_t i;
+
+  if (next == NULL || !default_word_regexp)
+    return NULL;
+  len = obstack_object_size (current_input);
+  if (len == 0)
+    return NULL;
+
+  text = (char *) obstack_base (current_input);
+  for (i = 0; i < len; i++)
+    {
+      unsigned char ch = text[i];
+      if (c_isalpha (ch) || ch == '_'
+          || (lquote.length && ch == to_uchar (*lquote.string))
+          || (bcomm.length && ch == to_uchar (*bcomm.string))
+          || (in_argument && (ch == '(' || ch == ',' || ch == ')'))
+          || (sync_output && ch == '\n'))
+        return NULL;
+    }
+
+  obstack_1grow (current_input, '\0');
+  stats.inert_expansions++;
+  return (char *) obstack_base (current_input);
+}
+
+/*-----------------------------------------------------------------.
+| Release the text accepted by push_string_inert (), once it has   |
+| been shipped.                                                    |
+`-----------------------------------------------------------------*/
+
+void
+push_string_discard (void)
+{
+  obstack_free (current_input, next);
+  next = NULL;
+}
+
 /*------------------------------------------------------------------.
 | The function push_wrapup () pushes a string on the wrapup stack.  |
 | When the normal input stack gets empty, the wrapup stack will     |
@@ -322,6 +471,8 @@ push_wrapup (const char *s)
   i->line = current_line;
   i->u.u_s.string = (char *) obstack_copy0 (wrapup_stack, s, len);
   i->u.u_s.end = i->u.u_s.string + len;
+  i->u.u_s.repeat = 0;
+  i->u.u_s.loop = NULL;
   wsp = i;
 }
 
@@ -330,7 +481,7 @@ push_wrapup (const char *s)
 | The function pop_input () pops one level of input sources.  If the |
 | popped input_block is a file, current_file and current_line are    |
 | reset to the saved values before the memory for the input_block is |
-| released.                                                          |
+| released, unless quoted arguments are in use.                      |
 `-------------------------------------------------------------------*/
 
 static void
@@ -341,6 +492,10 @@ pop_input (void)
   switch (isp->type)
     {
     case INPUT_STRING:
+      if (isp->u.u_s.loop)
+        isp->u.u_s.loop (isp->u.u_s.loop_data, true);
+      break;
+
     case INPUT_MACRO:
       break;
 
@@ -354,7 +509,9 @@ pop_input (void)
             DEBUG_MESSAGE ("input exhausted");
         }
 
-      if (ferror (isp->u.u_f.fp))
+      if (isp->u.u_f.cached)
+        release_cached_file (isp->u.u_f.cached);
+      else if (ferror (isp->u.u_f.fp))
         {
           M4ERROR ((warning_status, 0, _("read error")));
           if (isp->u.u_f.close)
@@ -375,7 +532,8 @@ pop_input (void)
                 "INTERNAL ERROR: input stack botch in pop_input ()"));
       abort ();
     }
-  obstack_free (current_input, isp);
+  if (!quoted_arguments)
+    obstack_free (current_input, isp);
   next = NULL; /* might be set in push_string_init () */
 
   isp = tmp;
@@ -465,14 +623,26 @@ peek_input (void)
           ch = to_uchar (block->u.u_s.string[0]);
           if (ch != '\0')
             return ch;
+          if (block->u.u_s.loop)
+            return CHAR_LOOP;
+          if (block->u.u_s.repeat)
+            return to_uchar (block->u.u_s.start[0]);
           break;
 
         case INPUT_FILE:
-          ch = getc (block->u.u_f.fp);
-          if (ch != EOF)
+          if (block->u.u_f.cached)
             {
-              ungetc (ch, block->u.u_f.fp);
-              return ch;
+              if (block->u.u_f.text < block->u.u_f.end_text)
+                return to_uchar (*block->u.u_f.text);
+            }
+          else
+            {
+              ch = getc (block->u.u_f.fp);
+              if (ch != EOF)
+                {
+                  ungetc (ch, block->u.u_f.fp);
+                  return ch;
+                }
             }
           block->u.u_f.end = true;
           break;
@@ -532,6 +702,14 @@ next_char_1 (void)
           ch = to_uchar (*isp->u.u_s.string++);
           if (ch != '\0')
             return ch;
+          if (isp->u.u_s.repeat)
+            {
+              isp->u.u_s.repeat--;
+              isp->u.u_s.string = isp->u.u_s.start;
+              if (isp->u.u_s.loop)
+                isp->u.u_s.loop (isp->u.u_s.loop_data, false);
+              continue;
+            }
           break;
 
         case INPUT_FILE:
@@ -544,7 +722,13 @@ next_char_1 (void)
           /* If stdin is a terminal, calling getc after peek_input
              already called it would make the user have to hit ^D
              twice to quit.  */
-          ch = isp->u.u_f.end ? EOF : getc (isp->u.u_f.fp);
+          if (isp->u.u_f.end)
+            ch = EOF;
+          else if (isp->u.u_f.cached)
+            ch = (isp->u.u_f.text < isp->u.u_f.end_text
+                  ? to_uchar (*isp->u.u_f.text++) : EOF);
+          else
+            ch = getc (isp->u.u_f.fp);
           if (ch != EOF)
             {
               if (ch == '\n')
@@ -568,6 +752,30 @@ next_char_1 (void)
     }
 }
 
+/*------------------------------------------------------------------.
+| When peek_input () returns CHAR_LOOP, the input blocks above the  |
+| loop are exhausted, as is the current pass of the loop.  Pop      |
+| them, and start the next pass of the loop, or pop it too if it    |
+| was the last.                                                     |
+`------------------------------------------------------------------*/
+
+static void
+next_pass (void)
+{
+  while (isp->type != INPUT_STRING || !isp->u.u_s.loop
+         || isp->u.u_s.string[0])
+    pop_input ();
+
+  if (isp->u.u_s.repeat)
+    {
+      isp->u.u_s.repeat--;
+      isp->u.u_s.string = isp->u.u_s.start;
+      isp->u.u_s.loop (isp->u.u_s.loop_data, false);
+    }
+  else
+    pop_input ();
+}
+
 /*-------------------------------------------------------------------.
 | skip_line () simply discards all immediately following characters, |
 | upto the first newline.  It is only used from m4_dnl ().           |
@@ -809,8 +1017,113 @@ set_word_regexp (const char *regexp)
 }
 
 #endif /* ENABLE_CHANGEWORD */
+
+/*--------------------------------------------------------------.
+| Return true if words are read with the default word regexp,   |
+| that is, if they are the identifiers of C.                    |
+`--------------------------------------------------------------*/
+
+bool
+default_word_syntax (void)
+{
+  return default_word_regexp;
+}
 
 
+/*-------------------------------------------------------------------.
+| At the start of a macro argument, check whether the argument is a  |
+| single quoted string within the current input string, followed     |
+| directly by the comma or the close parenthesis that ends it.  If   |
+| so, consume the string, point TD at its contents in place, without |
+| copying them, and return true; the caller then reads the comma or  |
+| parenthesis.  The contents stay valid until the matching call of   |
+| release_quoted_arguments ().  Otherwise, return false and consume  |
+| nothing.                                                           |
+`-------------------------------------------------------------------*/
+
+bool
+quoted_argument (token_data *td)
+{
+  char *buffer;
+  char *p;
+  int quote_level = 1;
+  unsigned char ch;
+
+  if (!isp || isp->type != INPUT_STRING || isp->u.u_s.repeat
+      || lquote.length != 1 || rquote.length != 1 || !default_word_regexp)
+    return false;
+
+  /* The string must be what next_token () would read, and must end
+     within the block.  The scan is that of next_token ().  */
+  buffer = isp->u.u_s.string;
+  ch = to_uchar (*buffer);
+  if (ch != to_uchar (*lquote.string)
+      || (bcomm.length && ch == to_uchar (*bcomm.string))
+      || c_isalpha (ch) || ch == '_')
+    return false;
+  p = buffer + 1;
+  do
+    {
+      p = (char *) memchr2 (p, *lquote.string, *rquote.string,
+                            isp->u.u_s.end - p);
+      if (p == NULL)
+        return false;
+    }
+  while (*p++ == *rquote.string ? --quote_level : ++quote_level);
+
+  ch = to_uchar (*p);
+  if ((ch != ',' && ch != ')')
+      || ch == to_uchar (*lquote.string)
+      || (bcomm.length && ch == to_uchar (*bcomm.string)))
+    return false;
+
+  /* The closing quote is consumed, and never read again, so it can
+     terminate the contents.  */
+  p[-1] = '\0';
+  TOKEN_DATA_TYPE (td) = TOKEN_TEXT;
+  TOKEN_DATA_TEXT (td) = buffer + 1;
+  TOKEN_DATA_LEN (td) = p - buffer - 2;
+  isp->u.u_s.string = p;
+  quoted_arguments++;
+  stats.tokens[TOKEN_STRING]++;
+  return true;
+}
+
+/*----------------------------------------------------------------.
+| Return a mark for release_quoted_arguments (), which releases   |
+| the quoted arguments handed out since the mark was taken.       |
+`----------------------------------------------------------------*/
+
+int
+quoted_arguments_mark (void)
+{
+  return quoted_arguments;
+}
+
+void
+release_quoted_arguments (int mark)
+{
+  quoted_arguments = mark;
+}
+
+/*-------------------------------------------------------------------.
+| Return true if quoted arguments were handed out since MARK, and    |
+| the current input string is exhausted, as is the one below it.  A  |
+| macro call ending a string keeps that string alive below its       |
+| expansion while its quoted arguments are in use; once two strings  |
+| pile up that way, as they would in a recursion, the arguments had  |
+| better be copied so that the strings can go.                       |
+`-------------------------------------------------------------------*/
+
+bool
+quoted_arguments_at_end (int mark)
+{
+  return (quoted_arguments > mark && isp && isp->type == INPUT_STRING
+          && !isp->u.u_s.string[0] && !isp->u.u_s.repeat
+          && isp->prev && isp->prev->type == INPUT_STRING
+          && !isp->prev->u.u_s.string[0] && !isp->prev->u.u_s.repeat);
+}
+
 /*--------------------------------------------------------------------.
 | Parse and return a single token from the input stream.  A token     |
 | can either be TOKEN_EOF, if the input_stack is empty; it can be     |
@@ -845,12 +1158,18 @@ next_token (token_data *td, int *line)
 
  /* Can't consume character until after CHAR_MACRO is handled.  */
   ch = peek_input ();
+  while (ch == CHAR_LOOP)
+    {
+      next_pass ();
+      ch = peek_input ();
+    }
   if (ch == CHAR_EOF)
     {
 #ifdef DEBUG_INPUT
       xfprintf (stderr, "next_token -> EOF\n");
 #endif
       next_char ();
+      stats.tokens[TOKEN_EOF]++;
       return TOKEN_EOF;
     }
   if (ch == CHAR_MACRO)
@@ -861,6 +1180,7 @@ next_token (token_data *td, int *line)
       xfprintf (stderr, "next_token -> MACDEF (%s)\n",
                 find_builtin_by_addr (TOKEN_DATA_FUNC (td))->name);
 #endif
+      stats.tokens[TOKEN_MACDEF]++;
       return TOKEN_MACDEF;
     }
 
@@ -901,7 +1221,7 @@ next_token (token_data *td, int *line)
       while (1)
         {
           ch = peek_input ();
-          if (ch == CHAR_EOF)
+          if (ch == CHAR_EOF || ch == CHAR_LOOP)
             break;
           obstack_1grow (&token_stack, ch);
           startpos = re_search (&word_regexp,
@@ -1020,6 +1340,7 @@ next_token (token_data *td, int *line)
   obstack_1grow (&token_stack, '\0');
 
   TOKEN_DATA_TYPE (td) = TOKEN_TEXT;
+  TOKEN_DATA_LEN (td) = obstack_object_size (&token_stack) - 1;
   TOKEN_DATA_TEXT (td) = (char *) obstack_finish (&token_stack);
 #ifdef ENABLE_CHANGEWORD
   if (orig_text == NULL)
@@ -1030,6 +1351,7 @@ next_token (token_data *td, int *line)
   xfprintf (stderr, "next_token -> %s (%s)\n",
             token_type_string (type), TOKEN_DATA_TEXT (td));
 #endif
+  stats.tokens[type]++;
   return type;
 }
 
@@ -1051,6 +1373,10 @@ peek_token (void)
     {
       result = TOKEN_MACDEF;
     }
+  else if (ch == CHAR_LOOP)
+    {
+      result = TOKEN_SIMPLE;
+    }
   else if (MATCH (ch, bcomm.string, false))
     {
       result = TOKEN_STRING;
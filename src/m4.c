@@ -72,6 +72,19 @@ int warning_status = 0;
 /* Artificial limit for expansion_level in macro.c.  */
 int nesting_limit = 1024;
 
+/* Size of the buffer for diversion 0, 0 to use stdio, or -1 for a
+   default depending on stdout (--output-buffer).  */
+int output_buffer_size = -1;
+
+/* Size of the cache of included file contents, 0 for none
+   (--include-cache).  */
+int include_cache_size = 16 * 1024 * 1024;
+
+#ifdef ENABLE_ASYNC_OUTPUT
+/* Write diversion 0 from a separate thread (--async-output).  */
+int async_output = 0;
+#endif
+
 #ifdef ENABLE_CHANGEWORD
 /* User provided regexp for describing m4 words.  */
 const char *user_word_regexp = "";
@@ -89,7 +102,9 @@ struct macro_definition
 };
 typedef struct macro_definition macro_definition;
 
-/* Error handling functions.  */
+/* Error handling functions.  Each writes first any output held in
+   memory for diversion 0, so that a diagnostic comes after the output
+   that preceded it, even when stderr goes to the same file.  */
 
 /*-----------------------.
 | Wrapper around error.  |
@@ -99,6 +114,7 @@ void
 m4_error (int status, int errnum, const char *format, ...)
 {
   va_list args;
+  output_flush ();
   va_start (args, format);
   verror_at_line (status, errnum, current_line ? current_file : NULL,
                   current_line, format, args);
@@ -111,6 +127,7 @@ void
 m4_failure (int errnum, const char *format, ...)
 {
   va_list args;
+  output_flush ();
   va_start (args, format);
   verror_at_line (EXIT_FAILURE, errnum, current_line ? current_file : NULL,
                   current_line, format, args);
@@ -126,6 +143,7 @@ m4_error_at_line (int status, int errnum, const char *file, int line,
                   const char *format, ...)
 {
   va_list args;
+  output_flush ();
   va_start (args, format);
   verror_at_line (status, errnum, line ? file : NULL, line, format, args);
   if (fatal_warnings && ! retcode)
@@ -138,6 +156,7 @@ m4_failure_at_line (int errnum, const char *file, int line,
                     const char *format, ...)
 {
   va_list args;
+  output_flush ();
   va_start (args, format);
   verror_at_line (EXIT_FAILURE, errnum, line ? file : NULL,
                   line, format, args);
@@ -226,10 +245,17 @@ Operation modes:\n\
       --help                   display this help and exit\n\
       --version                output version information and exit\n\
 "), stdout);
+#ifdef ENABLE_ASYNC_OUTPUT
+      fputs (_("\
+      --async-output           write output from a separate thread\n\
+"), stdout);
+#endif
       fputs (_("\
   -E, --fatal-warnings         once: warnings become errors, twice: stop\n\
                                  execution at first error\n\
   -i, --interactive            unbuffer output, ignore interrupts\n\
+      --output-buffer=SIZE     buffer SIZE bytes of output, 0 to use stdio\n\
+                                 [1048576 unless output is a terminal]\n\
   -P, --prefix-builtins        force a `m4_' prefix to all builtins\n\
   -Q, --quiet, --silent        suppress some warnings for builtins\n\
 "), stdout);
@@ -248,6 +274,8 @@ Operation modes:\n\
 Preprocessor features:\n\
   -D, --define=NAME[=VALUE]    define NAME as having VALUE, or empty\n\
   -I, --include=DIRECTORY      append DIRECTORY to include path\n\
+      --include-cache=SIZE     cache up to SIZE bytes of included files,\n\
+                                 0 to read them every time [16777216]\n\
   -s, --synclines              generate `#line NUM \"FILE\"' lines\n\
   -U, --undefine=NAME          undefine NAME\n\
 "), stdout);
@@ -263,16 +291,40 @@ Limits control:\n\
       fputs (_("\
 Frozen state files:\n\
   -F, --freeze-state=FILE      produce a frozen state on FILE at end\n\
+      --freeze-format=VERSION  write frozen state in format VERSION [1]\n\
   -R, --reload-state=FILE      reload a frozen state from FILE at start\n\
 "), stdout);
       puts ("");
       fputs (_("\
+Server and batch modes:\n\
+      --server=SOCKET          expand each request received on SOCKET from\n\
+                                 the state set up by the other options\n\
+      --connect=SOCKET         ask the server on SOCKET to expand FILEs,\n\
+                                 with the -D, -U, -s and -t options given\n\
+      --batch                  expand each FILE on its own from the state\n\
+                                 set up by the other options, into FILE\n\
+                                 without its .m4 suffix, or else FILE.out\n\
+  -j, --jobs=NUMBER            run up to NUMBER files of --batch at once [1]\n\
+      --collect                write the outputs of --batch to stdout, in\n\
+                                 the order of the FILEs\n\
+      --prelude=FILE           read FILE as part of the state of --batch or\n\
+                                 --server, rather than as one of its FILEs\n\
+"), stdout);
+      puts ("");
+      fputs (_("\
 Debugging:\n\
   -d, --debug[=FLAGS]          set debug level (no FLAGS implies `aeq')\n\
       --debugfile[=FILE]       redirect debug and trace output to FILE\n\
                                  (default stderr, discard if empty string)\n\
   -l, --arglength=NUM          restrict macro tracing size\n\
+      --profile[=FILE]         report time spent in each macro to FILE\n\
+                                 at exit (default stderr)\n\
+      --profile-stacks=FILE    sample the stack of macro expansions, and\n\
+                                 write it to FILE in collapsed format\n\
+      --stats[=FILE]           print internal statistics to FILE at exit\n\
+                                 (default stderr)\n\
   -t, --trace=NAME             trace NAME when it is defined\n\
+      --trace-json=FILE        write traces to FILE as JSON lines\n\
 "), stdout);
       puts ("");
       fputs (_("\
@@ -317,6 +369,21 @@ enum
   DEBUGFILE_OPTION = CHAR_MAX + 1,      /* no short opt */
   DIVERSIONS_OPTION,                    /* not quite -N, because of message */
   WARN_MACRO_SEQUENCE_OPTION,           /* no short opt */
+  OUTPUT_BUFFER_OPTION,                 /* no short opt */
+  INCLUDE_CACHE_OPTION,                 /* no short opt */
+  FREEZE_FORMAT_OPTION,                 /* no short opt */
+  PROFILE_OPTION,                       /* no short opt */
+  PROFILE_STACKS_OPTION,                /* no short opt */
+  TRACE_JSON_OPTION,                    /* no short opt */
+  STATS_OPTION,                         /* no short opt */
+  SERVER_OPTION,                        /* no short opt */
+  CONNECT_OPTION,                       /* no short opt */
+  BATCH_OPTION,                         /* no short opt */
+  COLLECT_OPTION,                       /* no short opt */
+  PRELUDE_OPTION,                       /* no short opt */
+#ifdef ENABLE_ASYNC_OUTPUT
+  ASYNC_OUTPUT_OPTION,                  /* no short opt */
+#endif
 
   HELP_OPTION,                          /* no short opt */
   VERSION_OPTION                        /* no short opt */
@@ -334,6 +401,7 @@ static const struct option long_options[] =
   {"hashsize", required_argument, NULL, 'H'},
   {"include", required_argument, NULL, 'I'},
   {"interactive", no_argument, NULL, 'i'},
+  {"jobs", required_argument, NULL, 'j'},
   {"nesting-limit", required_argument, NULL, 'L'},
   {"prefix-builtins", no_argument, NULL, 'P'},
   {"quiet", no_argument, NULL, 'Q'},
@@ -350,6 +418,21 @@ static const struct option long_options[] =
   {"debugfile", optional_argument, NULL, DEBUGFILE_OPTION},
   {"diversions", required_argument, NULL, DIVERSIONS_OPTION},
   {"warn-macro-sequence", optional_argument, NULL, WARN_MACRO_SEQUENCE_OPTION},
+  {"output-buffer", required_argument, NULL, OUTPUT_BUFFER_OPTION},
+  {"include-cache", required_argument, NULL, INCLUDE_CACHE_OPTION},
+  {"freeze-format", required_argument, NULL, FREEZE_FORMAT_OPTION},
+  {"profile", optional_argument, NULL, PROFILE_OPTION},
+  {"profile-stacks", required_argument, NULL, PROFILE_STACKS_OPTION},
+  {"trace-json", required_argument, NULL, TRACE_JSON_OPTION},
+  {"stats", optional_argument, NULL, STATS_OPTION},
+  {"server", required_argument, NULL, SERVER_OPTION},
+  {"connect", required_argument, NULL, CONNECT_OPTION},
+  {"batch", no_argument, NULL, BATCH_OPTION},
+  {"collect", no_argument, NULL, COLLECT_OPTION},
+  {"prelude", required_argument, NULL, PRELUDE_OPTION},
+#ifdef ENABLE_ASYNC_OUTPUT
+  {"async-output", no_argument, NULL, ASYNC_OUTPUT_OPTION},
+#endif
 
   {"help", no_argument, NULL, HELP_OPTION},
   {"version", no_argument, NULL, VERSION_OPTION},
@@ -388,15 +471,102 @@ process_file (const char *name)
   expand_input ();
 }
 
+/* Apply the command line option CODE, one of D, U, s or t, with its
+   argument ARG.  These must wait for the symbol table to be set up.  */
+static void
+process_option (int code, const char *arg)
+{
+  symbol *sym;
+
+  switch (code)
+    {
+    case 'D':
+      {
+        /* arg is read-only, so we need a copy.  */
+        char *macro_name = xstrdup (arg);
+        char *macro_value = strchr (macro_name, '=');
+        if (macro_value)
+          *macro_value++ = '\0';
+        define_user_macro (macro_name, macro_value, SYMBOL_INSERT);
+        free (macro_name);
+      }
+      break;
+
+    case 'U':
+      lookup_symbol (arg, SYMBOL_DELETE);
+      break;
+
+    case 't':
+      sym = lookup_symbol (arg, SYMBOL_INSERT);
+      SYMBOL_TRACED (sym) = true;
+      break;
+
+    case 's':
+      sync_output = 1;
+      break;
+
+    default:
+      M4ERROR ((0, 0, "INTERNAL ERROR: bad code in deferred arguments"));
+      abort ();
+    }
+}
+
+/* Expand the wrapped up text, produce the output or the frozen file
+   FROZEN_FILE_TO_WRITE in format FROZEN_FORMAT, and exit.  */
+static _Noreturn void
+finish (const char *frozen_file_to_write, int frozen_format)
+{
+  while (pop_wrapup ())
+    expand_input ();
+
+  /* Change debug stream back to stderr, to force flushing the debug
+     stream and detect any errors it might have encountered.  The
+     three standard streams are closed by close_stdin.  */
+  debug_set_output (NULL);
+
+  if (frozen_file_to_write)
+    produce_frozen_state (frozen_file_to_write, frozen_format);
+  else
+    {
+      make_diversion (0);
+      undivert_all ();
+    }
+  output_exit ();
+  free_macro_sequence ();
+  exit (retcode);
+}
+
+/* Run a request of --server or a file of --batch, with ARGC arguments
+   ARGV, each an option letter and its argument, or `f' and the name of
+   a file.  */
+static void
+run_request (int argc, char *const *argv)
+{
+  bool seen_file = false;
+  int i;
+
+  for (i = 0; i < argc; i++)
+    if (argv[i][0] == 'f')
+      {
+        seen_file = true;
+        process_file (argv[i] + 1);
+      }
+    else
+      process_option (argv[i][0], argv[i] + 1);
+  if (!seen_file)
+    process_file ("-");
+  finish (NULL, 0);
+}
+
 /* POSIX requires only -D, -U, and -s; and says that the first two
    must be recognized when interspersed with file names.  Traditional
    behavior also handles -s between files.  Starting OPTSTRING with
    '-' forces getopt_long to hand back file names as arguments to opt
    '\1', rather than reordering the command line.  */
 #ifdef ENABLE_CHANGEWORD
-#define OPTSTRING "-B:D:EF:GH:I:L:N:PQR:S:T:U:W:d::egil:o:st:"
+#define OPTSTRING "-B:D:EF:GH:I:L:N:PQR:S:T:U:W:d::egij:l:o:st:"
 #else
-#define OPTSTRING "-B:D:EF:GH:I:L:N:PQR:S:T:U:d::egil:o:st:"
+#define OPTSTRING "-B:D:EF:GH:I:L:N:PQR:S:T:U:d::egij:l:o:st:"
 #endif
 
 int
@@ -414,6 +584,19 @@ main (int argc, char *const *argv)
   const char *debugfile = NULL;
   const char *frozen_file_to_read = NULL;
   const char *frozen_file_to_write = NULL;
+  int frozen_format = 1;
+  const char *profile_name = NULL;
+  const char *profile_stacks_name = NULL;
+  const char *trace_json_name = NULL;
+  bool stats_wanted = false;
+  const char *stats_name = NULL;
+  const char *server_name = NULL;
+  const char *connect_name = NULL;
+  bool batch = false;
+  bool collect = false;
+  char **batch_files = NULL;
+  int batch_count = 0;
+  int jobs = 1;
   const char *macro_sequence = "";
 
   set_program_name (argv[0]);
@@ -502,6 +685,7 @@ main (int argc, char *const *argv)
       case 's':
       case 't':
       case '\1':
+      case PRELUDE_OPTION:
       case DEBUGFILE_OPTION:
         /* Arguments that cannot be handled until later are accumulated.  */
 
@@ -608,6 +792,76 @@ main (int argc, char *const *argv)
         macro_sequence = optarg;
         break;
 
+      case FREEZE_FORMAT_OPTION:
+        if (STREQ (optarg, "1"))
+          frozen_format = 1;
+        else if (STREQ (optarg, "2"))
+          frozen_format = 2;
+        else
+          m4_failure (0, _("unsupported frozen file format `%s'"), optarg);
+        break;
+
+      case PROFILE_OPTION:
+        profiling = true;
+        profile_name = optarg;
+        break;
+
+      case PROFILE_STACKS_OPTION:
+        profile_stacks_name = optarg;
+        break;
+
+      case TRACE_JSON_OPTION:
+        trace_json_name = optarg;
+        break;
+
+      case STATS_OPTION:
+        stats_wanted = true;
+        stats_name = optarg;
+        break;
+
+      case SERVER_OPTION:
+        server_name = optarg;
+        break;
+
+      case CONNECT_OPTION:
+        connect_name = optarg;
+        break;
+
+      case BATCH_OPTION:
+        batch = true;
+        break;
+
+      case COLLECT_OPTION:
+        collect = true;
+        break;
+
+      case 'j':
+        jobs = strtol (optarg, NULL, 10);
+        if (jobs <= 0)
+          {
+            error (0, 0, _("bad number of jobs: %s"), optarg);
+            usage (EXIT_FAILURE);
+          }
+        break;
+
+      case OUTPUT_BUFFER_OPTION:
+        output_buffer_size = strtol (optarg, NULL, 10);
+        if (output_buffer_size < 0)
+          output_buffer_size = 0;
+        break;
+
+      case INCLUDE_CACHE_OPTION:
+        include_cache_size = strtol (optarg, NULL, 10);
+        if (include_cache_size < 0)
+          include_cache_size = 0;
+        break;
+
+#ifdef ENABLE_ASYNC_OUTPUT
+      case ASYNC_OUTPUT_OPTION:
+        async_output = 1;
+        break;
+#endif
+
       case VERSION_OPTION:
         version_etc (stdout, PACKAGE, PACKAGE_NAME, VERSION, AUTHORS, NULL);
         exit (EXIT_SUCCESS);
@@ -620,11 +874,59 @@ main (int argc, char *const *argv)
 
   defines = head;
 
+  /* A client only passes on the options that make sense per request,
+     encoded as in run_request (), and the file names.  */
+  if (connect_name)
+    {
+      char **request = XNMALLOC (argc, char *);
+      int count = 0;
+
+      for (defn = defines; defn; defn = defn->next)
+        if (defn->code != DEBUGFILE_OPTION)
+          request[count++] = xasprintf ("%c%s",
+                                        (defn->code == '\1'
+                                         || defn->code == PRELUDE_OPTION
+                                         ? 'f' : defn->code),
+                                        defn->arg ? defn->arg : "");
+      for (; optind < argc; optind++)
+        request[count++] = xasprintf ("f%s", argv[optind]);
+      exit (server_request (connect_name, count, request));
+    }
+
+  if (batch)
+    {
+      if (server_name)
+        {
+          error (0, 0, _("--batch and --server are mutually exclusive"));
+          usage (EXIT_FAILURE);
+        }
+      batch_files = XNMALLOC (argc, char *);
+    }
+
+#ifdef ENABLE_ASYNC_OUTPUT
+  /* The output thread would not survive the fork of each request.  */
+  if (server_name || batch)
+    async_output = 0;
+#endif
+
   /* Do the basic initializations.  */
   if (debugfile && !debug_set_output (debugfile))
     M4ERROR ((warning_status, errno, _("cannot set debug file `%s'"),
               debugfile));
 
+  /* Interactive output must not linger in a buffer.  */
+  if (interactive)
+    output_buffer_size = 0;
+
+  if (profiling)
+    profile_init (profile_name);
+  if (profile_stacks_name)
+    profile_stacks_init (profile_stacks_name);
+  if (trace_json_name)
+    trace_json_init (trace_json_name);
+  if (stats_wanted)
+    stats_init (stats_name);
+
   input_init ();
   output_init ();
   symtab_init ();
@@ -650,37 +952,18 @@ main (int argc, char *const *argv)
   while (defines != NULL)
     {
       macro_definition *next;
-      symbol *sym;
 
       switch (defines->code)
         {
-        case 'D':
-          {
-            /* defines->arg is read-only, so we need a copy.  */
-            char *macro_name = xstrdup (defines->arg);
-            char *macro_value = strchr (macro_name, '=');
-            if (macro_value)
-              *macro_value++ = '\0';
-            define_user_macro (macro_name, macro_value, SYMBOL_INSERT);
-            free (macro_name);
-          }
-          break;
-
-        case 'U':
-          lookup_symbol (defines->arg, SYMBOL_DELETE);
-          break;
-
-        case 't':
-          sym = lookup_symbol (defines->arg, SYMBOL_INSERT);
-          SYMBOL_TRACED (sym) = true;
-          break;
-
-        case 's':
-          sync_output = 1;
-          break;
-
         case '\1':
           seen_file = true;
+          if (batch)
+            batch_files[batch_count++] = (char *) defines->arg;
+          else
+            process_file (defines->arg);
+          break;
+
+        case PRELUDE_OPTION:
           process_file (defines->arg);
           break;
 
@@ -691,8 +974,8 @@ main (int argc, char *const *argv)
           break;
 
         default:
-          M4ERROR ((0, 0, "INTERNAL ERROR: bad code in deferred arguments"));
-          abort ();
+          process_option (defines->code, defines->arg);
+          break;
         }
 
       next = defines->next;
@@ -701,32 +984,30 @@ main (int argc, char *const *argv)
     }
 
   /* Handle remaining input files.  Each file is pushed on the input,
-     and the input read.  Wrapup text is handled separately later.  */
+     and the input read.  Wrapup text is handled separately later.
+     For a server, they only set up the state requests start from.  A
+     batch expands each of them on its own, from the state so far.  */
+
+  if (batch)
+    {
+      for (; optind < argc; optind++)
+        batch_files[batch_count++] = argv[optind];
+      if (batch_count == 0)
+        batch_files[batch_count++] = (char *) "-";
+      exit (run_batch (batch_count, batch_files, jobs, collect,
+                       run_request));
+    }
 
-  if (optind == argc && !seen_file)
+  if (optind == argc && !seen_file && !server_name)
     process_file ("-");
   else
     for (; optind < argc; optind++)
       process_file (argv[optind]);
 
-  /* Now handle wrapup text.  */
-
-  while (pop_wrapup ())
-    expand_input ();
+  if (server_name)
+    serve (server_name, run_request);
 
-  /* Change debug stream back to stderr, to force flushing the debug
-     stream and detect any errors it might have encountered.  The
-     three standard streams are closed by close_stdin.  */
-  debug_set_output (NULL);
+  /* Now handle wrapup text.  */
 
-  if (frozen_file_to_write)
-    produce_frozen_state (frozen_file_to_write);
-  else
-    {
-      make_diversion (0);
-      undivert_all ();
-    }
-  output_exit ();
-  free_macro_sequence ();
-  exit (retcode);
+  finish (frozen_file_to_write, frozen_format);
 }
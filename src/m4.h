@@ -110,6 +110,7 @@ typedef struct string STRING;
 /* Those must come first.  */
 typedef struct token_data token_data;
 typedef void builtin_func (struct obstack *, int, token_data **);
+typedef void loop_func (void *, bool);
 
 /* Gnulib's stdbool doesn't work with bool bitfields.  For nicer
    debugging, use bool when we know it works, but use the more
@@ -132,6 +133,11 @@ extern int max_debug_argument_length;   /* -l */
 extern int suppress_warnings;           /* -Q */
 extern int warning_status;              /* -E */
 extern int nesting_limit;               /* -L */
+extern int output_buffer_size;          /* --output-buffer */
+extern int include_cache_size;          /* --include-cache */
+#ifdef ENABLE_ASYNC_OUTPUT
+extern int async_output;                /* --async-output */
+#endif
 #ifdef ENABLE_CHANGEWORD
 extern const char *user_word_regexp;    /* -W */
 #endif
@@ -245,7 +251,38 @@ extern void debug_message_prefix (void);
 
 extern void trace_prepre (const char *, int);
 extern void trace_pre (const char *, int, int, token_data **);
-extern void trace_post (const char *, int, int, const char *);
+extern void trace_post (const char *, int, int, token_data **, const char *);
+extern void trace_json_init (const char *);
+extern void trace_json_flush (void);
+extern bool trace_json_active (void);
+
+/* An expansion in progress, as seen by the profilers of --profile
+   and --profile-stacks.  Each call of expand_macro () links one on
+   its stack.  */
+typedef struct macro_frame macro_frame;
+struct macro_frame
+{
+  macro_frame *caller;          /* frame of the enclosing expansion */
+  const char *name;             /* name of the macro */
+  const char *file;             /* location of the call */
+  int line;
+  struct macro_profile *profile; /* statistics of the macro name */
+  uintmax_t start;              /* time of entry, in nanoseconds */
+  uintmax_t children;           /* time spent in nested expansions */
+};
+
+extern bool profiling;          /* --profile, --profile-stacks */
+extern macro_frame *current_frame;
+
+extern void profile_init (const char *);
+extern void profile_stacks_init (const char *);
+extern void stats_init (const char *);
+extern bool stats_value (const char *, uintmax_t *);
+extern void stats_report (FILE *);
+extern void debug_forked (void);
+extern void profile_enter (macro_frame *, const char *, size_t);
+extern void profile_leave (macro_frame *, int, token_data **, const char *,
+                           bool);
 
 /* File: input.c  --- lexical definitions.  */
 
@@ -281,6 +318,7 @@ struct token_data
 #ifdef ENABLE_CHANGEWORD
           char *original_text;
 #endif
+          size_t len;           /* strlen (text), see TOKEN_DATA_LEN */
         }
       u_t;
       builtin_func *func;
@@ -290,6 +328,9 @@ struct token_data
 
 #define TOKEN_DATA_TYPE(Td)             ((Td)->type)
 #define TOKEN_DATA_TEXT(Td)             ((Td)->u.u_t.text)
+/* Only maintained for tokens from next_token () and for the arguments
+   of macro calls.  */
+#define TOKEN_DATA_LEN(Td)              ((Td)->u.u_t.len)
 #ifdef ENABLE_CHANGEWORD
 # define TOKEN_DATA_ORIG_TEXT(Td)       ((Td)->u.u_t.original_text)
 #endif
@@ -298,16 +339,44 @@ struct token_data
 typedef enum token_type token_type;
 typedef enum token_data_type token_data_type;
 
+/* Counters of internal events, reported by m4stats and --stats.  They
+   are plain increments, cheap enough to be always maintained.  */
+struct m4_statistics
+{
+  uintmax_t tokens[TOKEN_MACDEF + 1];   /* tokens read, by type */
+  uintmax_t macro_calls;                /* calls of expand_macro () */
+  int max_expansion_level;              /* deepest nesting of calls */
+  uintmax_t pushed_strings;             /* expansions pushed back */
+  uintmax_t pushed_bytes;               /* bytes of those expansions */
+  uintmax_t inert_expansions;           /* expansions not rescanned */
+  uintmax_t ifelse_dispatches;          /* ifelse chains looked up */
+  uintmax_t diversion_spills;           /* diversions moved to files */
+  uintmax_t include_cache_hits;         /* includes read from the cache */
+};
+
+extern struct m4_statistics stats;
+
 extern void input_init (void);
 extern token_type peek_token (void);
 extern token_type next_token (token_data *, int *);
+extern bool quoted_argument (token_data *);
+extern int quoted_arguments_mark (void);
+extern void release_quoted_arguments (int);
+extern bool quoted_arguments_at_end (int);
 extern void skip_line (void);
 
 /* push back input */
+/* Cached contents of an included file, from path.c.  */
+typedef struct cached_file cached_file;
+
 extern void push_file (FILE *, const char *, bool);
+extern void push_cached_file (cached_file *, const char *);
 extern void push_macro (builtin_func *);
 extern struct obstack *push_string_init (void);
 extern const char *push_string_finish (void);
+extern void push_string_loop (size_t, loop_func *, void *);
+extern const char *push_string_inert (bool);
+extern void push_string_discard (void);
 extern void push_wrapup (const char *);
 extern bool pop_wrapup (void);
 
@@ -331,6 +400,7 @@ extern void set_comment (const char *, const char *);
 #ifdef ENABLE_CHANGEWORD
 extern void set_word_regexp (const char *);
 #endif
+extern bool default_word_syntax (void);
 
 /* File: output.c --- output functions.  */
 extern int current_diversion;
@@ -338,12 +408,15 @@ extern int output_current_line;
 
 extern void output_init (void);
 extern void output_exit (void);
+extern void output_flush (void);
+extern void output_unspill (void);
+extern void output_share_stdout (bool);
 extern void output_text (const char *, int);
 extern void shipout_text (struct obstack *, const char *, int, int);
 extern void make_diversion (int);
 extern void insert_diversion (int);
 extern void insert_file (FILE *);
-extern void freeze_diversions (FILE *);
+extern void freeze_diversions (FILE *, int);
 
 /* File symtab.c  --- symbol table definitions.  */
 
@@ -358,6 +431,7 @@ enum symbol_lookup
 };
 
 /* Symbol table entry.  */
+struct ifelse_dispatch;
 struct symbol
 {
   struct symbol *stack; /* pushdef stack */
@@ -366,11 +440,17 @@ struct symbol
   bool_bitfield macro_args : 1;
   bool_bitfield blind_no_args : 1;
   bool_bitfield deleted : 1;
+  bool_bitfield mapped : 1;
+  bool_bitfield inert : 1;
   int pending_expansions;
 
   size_t hash;
   char *name;
   token_data data;
+
+  /* For a user macro, what expand_user_macro () found out about its
+     definition being a chain of ifelse, or NULL if not yet known.  */
+  struct ifelse_dispatch *dispatch;
 };
 
 #define SYMBOL_STACK(S)         ((S)->stack)
@@ -378,11 +458,14 @@ struct symbol
 #define SYMBOL_MACRO_ARGS(S)    ((S)->macro_args)
 #define SYMBOL_BLIND_NO_ARGS(S) ((S)->blind_no_args)
 #define SYMBOL_DELETED(S)       ((S)->deleted)
+#define SYMBOL_MAPPED(S)        ((S)->mapped)
+#define SYMBOL_INERT(S)         ((S)->inert)
 #define SYMBOL_PENDING_EXPANSIONS(S) ((S)->pending_expansions)
 #define SYMBOL_NAME(S)          ((S)->name)
 #define SYMBOL_TYPE(S)          (TOKEN_DATA_TYPE (&(S)->data))
 #define SYMBOL_TEXT(S)          (TOKEN_DATA_TEXT (&(S)->data))
 #define SYMBOL_FUNC(S)          (TOKEN_DATA_FUNC (&(S)->data))
+#define SYMBOL_DISPATCH(S)      ((S)->dispatch)
 
 typedef enum symbol_lookup symbol_lookup;
 typedef struct symbol symbol;
@@ -393,7 +476,11 @@ typedef void hack_symbol (symbol *, void *);
 extern void free_symbol (symbol *sym);
 extern void symtab_init (void);
 extern symbol *lookup_symbol (const char *, symbol_lookup);
+extern size_t symbol_hash (const char *);
+extern symbol *new_symbol (char *, size_t);
+extern void install_symbol_chain (size_t, symbol *);
 extern void hack_all_symbols (hack_symbol *, void *);
+extern void symtab_load (size_t *, size_t *, size_t *);
 
 /* File: macro.c  --- macro expansion.  */
 
@@ -410,6 +497,7 @@ struct builtin
   bool_bitfield gnu_extension : 1;
   bool_bitfield groks_macro_args : 1;
   bool_bitfield blind_if_no_args : 1;
+  bool_bitfield inert : 1;
   builtin_func *func;
 };
 
@@ -432,9 +520,12 @@ struct re_registers;
 
 extern void builtin_init (void);
 extern void define_builtin (const char *, const builtin *, symbol_lookup);
+extern void set_builtin_definition (symbol *, const builtin *);
 extern void set_macro_sequence (const char *);
 extern void free_macro_sequence (void);
 extern void define_user_macro (const char *, const char *, symbol_lookup);
+extern void define_mapped_macro (const char *, char *, symbol_lookup);
+extern void set_mapped_definition (symbol *, char *);
 extern void undivert_all (void);
 extern void expand_user_macro (struct obstack *, symbol *, int, token_data **);
 extern void m4_placeholder (struct obstack *, int, token_data **);
@@ -450,7 +541,11 @@ extern const builtin *find_builtin_by_name (const char *);
 extern void include_init (void);
 extern void include_env_init (void);
 extern void add_include_directory (const char *);
+extern void forget_include_paths (void);
 extern FILE *m4_path_search (const char *, char **);
+extern cached_file *include_search (const char *, char **, FILE **);
+extern const char *cached_file_text (const cached_file *, size_t *);
+extern void release_cached_file (cached_file *);
 
 /* File: eval.c  --- expression evaluation.  */
 
@@ -462,8 +557,17 @@ extern void expand_format (struct obstack *, int, token_data **);
 
 /* File: freeze.c --- frozen state files.  */
 
-extern void produce_frozen_state (const char *);
+extern void produce_frozen_state (const char *, int);
 extern void reload_frozen_state (const char *);
+extern void freeze_put_number (FILE *, uintmax_t, int);
+
+/* File: server.c --- server and batch modes.  */
+
+typedef void forked_job (int, char *const *);
+
+extern int server_request (const char *, int, char *const *);
+extern _Noreturn void serve (const char *, forked_job *);
+extern int run_batch (int, char *const *, int, bool, forked_job *);
 
 /* Debugging the memory allocator.  */
 
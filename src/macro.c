@@ -24,7 +24,7 @@
 
 #include "m4.h"
 
-static void expand_macro (symbol *);
+static void expand_macro (symbol *, struct obstack *);
 static void expand_token (struct obstack *, token_type, token_data *, int);
 
 /* Current recursion level in expand_macro ().  */
@@ -35,20 +35,34 @@ static int macro_call_id = 0;
 
 /* The shared stack of collected arguments for macro calls; as each
    argument is collected, it is finished and its location stored in
-   argv_stack.  Normally, this stack can be used simultaneously by
-   multiple macro calls; the exception is when an outer macro has
-   generated some text, then calls a nested macro, in which case the
-   nested macro must use a local stack to leave the unfinished text
-   alone.  Too bad obstack.h does not provide an easy way to reopen a
-   finished object for further growth, but in practice this does not
-   hurt us too much.  */
+   the argument records of the call.  Normally, this stack can be used
+   simultaneously by multiple macro calls; the exception is when an
+   outer macro has generated some text, then calls a nested macro, in
+   which case the nested macro must use the stack of its arg_level to
+   leave the unfinished text alone.  Too bad obstack.h does not provide
+   an easy way to reopen a finished object for further growth, but in
+   practice this does not hurt us too much.  */
 static struct obstack argc_stack;
 
-/* The shared stack of pointers to collected arguments for macro
-   calls.  This object is never finished; we exploit the fact that
-   obstack_blank_fast is documented to take a negative size to reduce
-   the size again.  */
-static struct obstack argv_stack;
+/* Storage for the arguments of the macro call at one expansion level.
+   Only one call collects its arguments at a given level at any time,
+   so the storage is reused by every call at that level, and only ever
+   grows.  */
+struct arg_level
+{
+  token_data *records;          /* inline records of the arguments */
+  token_data **argv;            /* pointers to them, passed to builtins */
+  size_t size;                  /* allocated entries of both */
+  bool text_init;               /* whether text is initialized */
+  struct obstack text;          /* argument text when argc_stack is busy */
+};
+
+typedef struct arg_level arg_level;
+
+/* The arg_level of each expansion level, indexed by expansion_level,
+   allocated on first use.  */
+static arg_level **arg_levels;
+static size_t arg_levels_size;
 
 /*----------------------------------------------------------------------.
 | This function read all input, and expands each token, one at a time.  |
@@ -61,14 +75,66 @@ expand_input (void)
   token_data td;
   int line;
 
+  size_t i;
+
   obstack_init (&argc_stack);
-  obstack_init (&argv_stack);
 
   while ((t = next_token (&td, &line)) != TOKEN_EOF)
     expand_token ((struct obstack *) NULL, t, &td, line);
 
   obstack_free (&argc_stack, NULL);
-  obstack_free (&argv_stack, NULL);
+  for (i = 0; i < arg_levels_size; i++)
+    if (arg_levels[i])
+      {
+        if (arg_levels[i]->text_init)
+          obstack_free (&arg_levels[i]->text, NULL);
+        free (arg_levels[i]->records);
+        free (arg_levels[i]->argv);
+        free (arg_levels[i]);
+      }
+  free (arg_levels);
+  arg_levels = NULL;
+  arg_levels_size = 0;
+}
+
+/*-----------------------------------------------------------------.
+| Return the argument storage of expansion level LEVEL, creating   |
+| it if needed.                                                    |
+`-----------------------------------------------------------------*/
+
+static arg_level *
+get_arg_level (int level)
+{
+  while ((size_t) level >= arg_levels_size)
+    {
+      size_t old_size = arg_levels_size;
+      arg_levels = (arg_level **) x2nrealloc (arg_levels, &arg_levels_size,
+                                              sizeof *arg_levels);
+      memset (arg_levels + old_size, 0,
+              (arg_levels_size - old_size) * sizeof *arg_levels);
+    }
+  if (arg_levels[level] == NULL)
+    arg_levels[level] = (arg_level *) xzalloc (sizeof (arg_level));
+  return arg_levels[level];
+}
+
+/*------------------------------------------------------------------.
+| Return the record of argument I in the storage LEVEL, making room |
+| for it if needed.                                                 |
+`------------------------------------------------------------------*/
+
+static token_data *
+arg_record (arg_level *level, int i)
+{
+  if ((size_t) i >= level->size)
+    {
+      level->records = (token_data *) x2nrealloc (level->records,
+                                                  &level->size,
+                                                  sizeof *level->records);
+      level->argv = (token_data **) xnrealloc (level->argv, level->size,
+                                               sizeof *level->argv);
+    }
+  return &level->records[i];
 }
 
 
@@ -115,7 +181,7 @@ expand_token (struct obstack *obs, token_type t, token_data *td, int line)
 #endif
         }
       else
-        expand_macro (sym);
+        expand_macro (sym, obs);
       break;
 
     default:
@@ -133,7 +199,9 @@ expand_token (struct obstack *obs, token_type t, token_data *td, int line)
 | tokens, until it finds a comma or an right parenthesis at the same |
 | level of parentheses.  It returns a flag indicating whether the    |
 | argument read is the last for the active macro call.  The argument |
-| is built on the obstack OBS, indirectly through expand_token ().   |
+| is built on the obstack OBS, indirectly through expand_token (),   |
+| except for an argument that is just a quoted string, which is left |
+| in place in the input by quoted_argument ().                       |
 `-------------------------------------------------------------------*/
 
 static bool
@@ -151,6 +219,8 @@ expand_argument (struct obstack *obs, token_data *argp)
   /* Skip leading white space.  */
   do
     {
+      if (quoted_argument (argp))
+        return next_token (&td, NULL) == TOKEN_COMMA;
       t = next_token (&td, NULL);
     }
   while (t == TOKEN_SIMPLE && c_isspace (*TOKEN_DATA_TEXT (&td)));
@@ -167,6 +237,7 @@ expand_argument (struct obstack *obs, token_data *argp)
           if (paren_level == 0)
             {
               /* The argument MUST be finished, whether we want it or not.  */
+              size_t len = obstack_object_size (obs);
               obstack_1grow (obs, '\0');
               text = (char *) obstack_finish (obs);
 
@@ -174,6 +245,7 @@ expand_argument (struct obstack *obs, token_data *argp)
                 {
                   TOKEN_DATA_TYPE (argp) = TOKEN_TEXT;
                   TOKEN_DATA_TEXT (argp) = text;
+                  TOKEN_DATA_LEN (argp) = len;
                 }
               return t == TOKEN_COMMA;
             }
@@ -218,43 +290,50 @@ expand_argument (struct obstack *obs, token_data *argp)
     }
 }
 
-/*-------------------------------------------------------------.
-| Collect all the arguments to a call of the macro SYM.  The   |
-| arguments are stored on the obstack ARGUMENTS and a table of |
-| pointers to the arguments on the obstack ARGPTR.             |
-`-------------------------------------------------------------*/
+/*-----------------------------------------------------------------.
+| Collect all the arguments to a call of the macro SYM, and return |
+| their number.  The text of the arguments is stored on the        |
+| obstack ARGUMENTS, and their records in LEVEL, where argv points |
+| to them on return.                                               |
+`-----------------------------------------------------------------*/
 
-static void
-collect_arguments (symbol *sym, struct obstack *argptr,
-                   struct obstack *arguments)
+static int
+collect_arguments (symbol *sym, arg_level *level, struct obstack *arguments)
 {
   token_data td;
   token_data *tdp;
   bool more_args;
   bool groks_macro_args = SYMBOL_MACRO_ARGS (sym);
+  int argc = 0;
+  int i;
 
-  TOKEN_DATA_TYPE (&td) = TOKEN_TEXT;
-  TOKEN_DATA_TEXT (&td) = SYMBOL_NAME (sym);
-  tdp = (token_data *) obstack_copy (arguments, &td, sizeof td);
-  obstack_ptr_grow (argptr, tdp);
+  tdp = arg_record (level, argc++);
+  TOKEN_DATA_TYPE (tdp) = TOKEN_TEXT;
+  TOKEN_DATA_TEXT (tdp) = SYMBOL_NAME (sym);
+  TOKEN_DATA_LEN (tdp) = strlen (SYMBOL_NAME (sym));
 
   if (peek_token () == TOKEN_OPEN)
     {
       next_token (&td, NULL); /* gobble parenthesis */
       do
         {
-          more_args = expand_argument (arguments, &td);
+          /* Nested calls use deeper levels, so TDP stays valid.  */
+          tdp = arg_record (level, argc++);
+          more_args = expand_argument (arguments, tdp);
 
-          if (!groks_macro_args && TOKEN_DATA_TYPE (&td) == TOKEN_FUNC)
+          if (!groks_macro_args && TOKEN_DATA_TYPE (tdp) == TOKEN_FUNC)
             {
-              TOKEN_DATA_TYPE (&td) = TOKEN_TEXT;
-              TOKEN_DATA_TEXT (&td) = (char *) "";
+              TOKEN_DATA_TYPE (tdp) = TOKEN_TEXT;
+              TOKEN_DATA_TEXT (tdp) = (char *) "";
+              TOKEN_DATA_LEN (tdp) = 0;
             }
-          tdp = (token_data *) obstack_copy (arguments, &td, sizeof td);
-          obstack_ptr_grow (argptr, tdp);
         }
       while (more_args);
     }
+
+  for (i = 0; i < argc; i++)
+    level->argv[i] = &level->records[i];
+  return argc;
 }
 
 
@@ -292,28 +371,36 @@ call_macro (symbol *sym, int argc, token_data **argv,
 
 /*-------------------------------------------------------------------.
 | The macro expansion is handled by expand_macro ().  It parses the  |
-| arguments, using collect_arguments (), and builds a table of       |
-| pointers to the arguments.  The arguments themselves are stored on |
-| a local obstack.  Expand_macro () uses call_macro () to do the     |
-| call of the macro.                                                 |
+| arguments, using collect_arguments (), into the storage of its     |
+| expansion level, with the text of the arguments on argc_stack or   |
+| on the obstack of that level.  Expand_macro () uses call_macro ()  |
+| to do the call of the macro.                                       |
 |                                                                    |
 | Expand_macro () is potentially recursive, since it calls           |
 | expand_argument (), which might call expand_token (), which might  |
 | call expand_macro ().                                              |
+|                                                                    |
+| The expansion is normally pushed back on input to be rescanned.    |
+| If SYM is marked inert and the expansion turns out to need no      |
+| rescanning, it is instead shipped directly to OBS, the argument    |
+| being collected, or to the output if OBS is NULL.                  |
 `-------------------------------------------------------------------*/
 
 static void
-expand_macro (symbol *sym)
+expand_macro (symbol *sym, struct obstack *obs)
 {
-  struct obstack arguments;     /* Alternate obstack if argc_stack is busy.  */
-  unsigned argv_base;           /* Size of argv_stack on entry.  */
-  bool use_argc_stack = true;   /* Whether argc_stack is safe.  */
+  arg_level *level;             /* Storage for the arguments.  */
+  struct obstack *arguments;    /* Where the argument text goes.  */
+  void *arguments_base;         /* Mark to release it.  */
+  int quoted_mark;              /* Mark to release quoted arguments.  */
   token_data **argv;
   int argc;
   struct obstack *expansion;
   const char *expanded;
+  const char *inert = NULL;     /* Expansion to ship without rescan.  */
   bool traced;
   int my_call_id;
+  macro_frame frame;            /* Profiler record of this expansion.  */
 
   /* Report errors at the location where the open parenthesis (if any)
      was found, but after expansion, restore global state back to the
@@ -328,6 +415,9 @@ expand_macro (symbol *sym)
 
   SYMBOL_PENDING_EXPANSIONS (sym)++;
   expansion_level++;
+  stats.macro_calls++;
+  if (expansion_level > stats.max_expansion_level)
+    stats.max_expansion_level = expansion_level;
   if (nesting_limit > 0 && expansion_level > nesting_limit)
     m4_failure (0, _("recursion limit of %d exceeded, use -L<N> to change it"),
                 nesting_limit);
@@ -337,25 +427,31 @@ expand_macro (symbol *sym)
 
   traced = (debug_level & DEBUG_TRACE_ALL) || SYMBOL_TRACED (sym);
 
-  argv_base = obstack_object_size (&argv_stack);
+  if (profiling)
+    profile_enter (&frame, SYMBOL_NAME (sym), sym->hash);
+
+  level = get_arg_level (expansion_level);
+  arguments = &argc_stack;
   if (obstack_object_size (&argc_stack) > 0)
     {
       /* We cannot use argc_stack if this is a nested invocation, and an
          outer invocation has an unfinished argument being
          collected.  */
-      obstack_init (&arguments);
-      use_argc_stack = false;
+      if (!level->text_init)
+        {
+          obstack_init (&level->text);
+          level->text_init = true;
+        }
+      arguments = &level->text;
     }
+  arguments_base = obstack_alloc (arguments, 0);
+  quoted_mark = quoted_arguments_mark ();
 
   if (traced && (debug_level & DEBUG_TRACE_CALL))
     trace_prepre (SYMBOL_NAME (sym), my_call_id);
 
-  collect_arguments (sym, &argv_stack,
-                     use_argc_stack ? &argc_stack : &arguments);
-
-  argc = ((obstack_object_size (&argv_stack) - argv_base)
-          / sizeof (token_data *));
-  argv = (token_data **) ((uintptr_t) obstack_base (&argv_stack) + argv_base);
+  argc = collect_arguments (sym, level, arguments);
+  argv = level->argv;
 
   loc_close_file = current_file;
   loc_close_line = current_line;
@@ -365,12 +461,32 @@ expand_macro (symbol *sym)
   if (traced)
     trace_pre (SYMBOL_NAME (sym), my_call_id, argc, argv);
 
+  /* Do not let the quoted arguments of recursive calls pile up input
+     strings: copy them, as any other argument, and let the strings
+     go.  */
+  if (quoted_arguments_at_end (quoted_mark))
+    {
+      int i;
+
+      for (i = 1; i < argc; i++)
+        if (TOKEN_DATA_TYPE (argv[i]) == TOKEN_TEXT)
+          TOKEN_DATA_TEXT (argv[i])
+            = (char *) obstack_copy (arguments, TOKEN_DATA_TEXT (argv[i]),
+                                     TOKEN_DATA_LEN (argv[i]) + 1);
+      release_quoted_arguments (quoted_mark);
+    }
+
   expansion = push_string_init ();
   call_macro (sym, argc, argv, expansion);
-  expanded = push_string_finish ();
+  if (SYMBOL_INERT (sym))
+    inert = push_string_inert (obs != NULL);
+  expanded = inert ? inert : push_string_finish ();
 
   if (traced)
-    trace_post (SYMBOL_NAME (sym), my_call_id, argc, expanded);
+    trace_post (SYMBOL_NAME (sym), my_call_id, argc, argv, expanded);
+
+  if (profiling)
+    profile_leave (&frame, argc, argv, expanded, inert != NULL);
 
   current_file = loc_close_file;
   current_line = loc_close_line;
@@ -381,9 +497,19 @@ expand_macro (symbol *sym)
   if (SYMBOL_DELETED (sym))
     free_symbol (sym);
 
-  if (use_argc_stack)
-    obstack_free (&argc_stack, argv[0]);
-  else
-    obstack_free (&arguments, NULL);
-  obstack_blank_fast (&argv_stack, -argc * sizeof (token_data *));
+  obstack_free (arguments, arguments_base);
+  release_quoted_arguments (quoted_mark);
+
+  /* Only now may an inert expansion grow OBS, which can be argc_stack
+     just released.  It is shipped from the location of the call, as
+     if it had been rescanned from input pushed there.  */
+  if (inert)
+    {
+      current_file = loc_open_file;
+      current_line = loc_open_line;
+      shipout_text (obs, inert, strlen (inert), loc_open_line);
+      current_file = loc_close_file;
+      current_line = loc_close_line;
+      push_string_discard ();
+    }
 }
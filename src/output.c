@@ -27,6 +27,13 @@
 #include "gl_avltree_oset.h"
 #include "gl_xoset.h"
 
+#ifdef ENABLE_ASYNC_OUTPUT
+# include <pthread.h>
+#endif
+#if HAVE_WRITEV
+# include <sys/uio.h>
+#endif
+
 /* Size of initial in-memory buffer size for diversions.  Small diversions
    would usually fit in.  */
 #define INITIAL_BUFFER_SIZE 512
@@ -38,6 +45,15 @@
 /* Size of buffer size to use while copying files.  */
 #define COPY_BUFFER_SIZE (32 * 512)
 
+/* Default size of the buffer for diversion 0, when standard output
+   is not a terminal.  */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+#ifdef ENABLE_ASYNC_OUTPUT
+/* Number of buffers in the ring shared with the output thread.  */
+# define ASYNC_BUFFER_COUNT 4
+#endif
+
 /* Output functions.  Most of the complexity is for handling cpp like
    sync lines.
 
@@ -124,6 +140,65 @@ static int tmp_file2_owner;
 /* True if tmp_file2 is more recently used.  */
 static bool tmp_file2_recent;
 
+/* Cache of the name of the temporary file being worked on, within
+   output_temp_dir, and of the place in it where DIVNUM goes.  */
+static char *tmp_name;
+static char *tmp_name_tail;
+
+/* True once cleanup_tmpfile is registered with atexit.  */
+static bool tmp_cleanup_registered;
+
+/* Unless output_buffer_size is 0, diversion 0 is normally an
+   in-memory buffer of that size rather than stdout.  Whenever it
+   runs out of room, its contents are written to the standard output
+   descriptor directly, bypassing stdio, so that large outputs need
+   few system calls.  */
+
+/* True while diversion 0 is managed this way.  */
+static bool stdout_buffered;
+
+/* The buffer used by diversion 0, when not using an output thread.  */
+static char *stdout_buffer;
+
+/* True while debug output shares stdout, in which case diversion 0
+   goes through stdio as usual, to keep both in order.  */
+static bool stdout_shared;
+
+#ifdef ENABLE_ASYNC_OUTPUT
+
+/* With --async-output, diversion 0 instead takes its buffer from a
+   ring of ASYNC_BUFFER_COUNT buffers.  Whenever the buffer being
+   filled runs out of room it is queued, and a separate thread writes
+   the queued buffers to standard output in order, while expansion
+   continues in the next free buffer.  */
+static char *async_ring[ASYNC_BUFFER_COUNT];
+
+/* Number of bytes to write from each queued buffer.  */
+static size_t async_length[ASYNC_BUFFER_COUNT];
+
+/* Index of the oldest queued buffer, and number of queued buffers.  */
+static int async_head;
+static int async_queued;
+
+/* True if the output thread should exit once the queue is empty.  */
+static bool async_quit;
+
+/* First errno value reported by write, or 0.  */
+static int async_errno;
+
+/* The variables above, but not the buffer contents, are protected by
+   async_lock.  The output thread waits on async_wake for more work,
+   and the main thread waits on async_done for the queue to shrink.  */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done = PTHREAD_COND_INITIALIZER;
+static pthread_t async_thread;
+
+/* True while the output thread is running.  */
+static bool async_active;
+
+#endif /* ENABLE_ASYNC_OUTPUT */
+
 
 /* Internal routines.  */
 
@@ -177,7 +252,7 @@ cleanup_tmpfile (void)
     }
 
   /* Clean up the temporary directory.  */
-  if (cleanup_temp_dir (output_temp_dir) != 0)
+  if (output_temp_dir && cleanup_temp_dir (output_temp_dir) != 0)
     fail = true;
   if (fail)
     _exit (exit_failure);
@@ -187,21 +262,19 @@ cleanup_tmpfile (void)
 static const char *
 m4_tmpname (int divnum)
 {
-  static char *buffer;
-  static char *tail;
-  if (buffer == NULL)
+  if (tmp_name == NULL)
     {
       size_t dirlen = strlen (output_temp_dir->dir_name);
       static char const subprefix[] = "/m4-";
       size_t size = dirlen + sizeof subprefix + INT_STRLEN_BOUND (int);
-      buffer = obstack_alloc (&diversion_storage, size);
-      memcpy (buffer, output_temp_dir->dir_name, dirlen);
-      memcpy (buffer + dirlen, subprefix, sizeof subprefix - 1);
-      tail = buffer + dirlen + sizeof subprefix - 1;
+      tmp_name = obstack_alloc (&diversion_storage, size);
+      memcpy (tmp_name, output_temp_dir->dir_name, dirlen);
+      memcpy (tmp_name + dirlen, subprefix, sizeof subprefix - 1);
+      tmp_name_tail = tmp_name + dirlen + sizeof subprefix - 1;
     }
   assert (0 < divnum);
-  sprintf (tail, "%d", divnum);
-  return buffer;
+  sprintf (tmp_name_tail, "%d", divnum);
+  return tmp_name;
 }
 
 /* Create a temporary file for diversion DIVNUM open for reading and
@@ -222,7 +295,9 @@ m4_tmpfile (int divnum)
       output_temp_dir = create_temp_dir ("m4-", NULL, true);
       if (output_temp_dir == NULL)
         m4_failure (errno, _("cannot create temporary file for diversion"));
-      atexit (cleanup_tmpfile);
+      if (!tmp_cleanup_registered)
+        atexit (cleanup_tmpfile);
+      tmp_cleanup_registered = true;
     }
   name = m4_tmpname (divnum);
   register_temp_file (output_temp_dir, name);
@@ -365,6 +440,329 @@ m4_tmprename (int oldnum, int newnum)
   return m4_tmpopen (newnum, false);
 }
 
+/* Write all LENGTH bytes of BUFFER to standard output, retrying after
+   partial writes and interrupts.  Return 0 on success, or an errno
+   value on failure.  */
+static int
+write_stdout (const char *buffer, size_t length)
+{
+  while (length)
+    {
+      ssize_t count = write (STDOUT_FILENO, buffer, length);
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return errno;
+        }
+      buffer += count;
+      length -= count;
+    }
+  return 0;
+}
+
+/* Write LENGTH1 bytes of BUFFER1 then LENGTH2 bytes of BUFFER2 to
+   standard output, with a single system call when possible.  Return 0
+   on success, or an errno value on failure.  */
+static int
+write_stdout2 (const char *buffer1, size_t length1,
+               const char *buffer2, size_t length2)
+{
+#if HAVE_WRITEV
+  struct iovec iov[2];
+
+  iov[0].iov_base = (char *) buffer1;
+  iov[0].iov_len = length1;
+  iov[1].iov_base = (char *) buffer2;
+  iov[1].iov_len = length2;
+  while (iov[0].iov_len)
+    {
+      ssize_t count = writev (STDOUT_FILENO, iov, 2);
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return errno;
+        }
+      if ((size_t) count >= iov[0].iov_len)
+        {
+          count -= iov[0].iov_len;
+          iov[1].iov_base = (char *) iov[1].iov_base + count;
+          iov[1].iov_len -= count;
+          break;
+        }
+      iov[0].iov_base = (char *) iov[0].iov_base + count;
+      iov[0].iov_len -= count;
+    }
+  return write_stdout (iov[1].iov_base, iov[1].iov_len);
+#else /* !HAVE_WRITEV */
+  int result = write_stdout (buffer1, length1);
+  return result ? result : write_stdout (buffer2, length2);
+#endif /* !HAVE_WRITEV */
+}
+
+/* Point diversion 0 at BUFFER, empty, as its in-memory buffer.  */
+static void
+stdout_attach (char *buffer)
+{
+  div0.u.buffer = buffer;
+  div0.size = output_buffer_size;
+  div0.used = 0;
+  if (output_diversion == &div0)
+    {
+      output_file = NULL;
+      output_cursor = buffer;
+      output_unused = output_buffer_size;
+    }
+}
+
+/* Point diversion 0 back at stdout.  */
+static void
+stdout_detach (void)
+{
+  div0.u.file = stdout;
+  div0.size = 0;
+  div0.used = 0;
+  if (output_diversion == &div0)
+    {
+      output_file = stdout;
+      output_cursor = NULL;
+      output_unused = 0;
+    }
+}
+
+#ifdef ENABLE_ASYNC_OUTPUT
+
+/* Body of the output thread.  Write queued buffers in order, until
+   told to quit.  After the first write error, the remaining buffers
+   are discarded, and the error is reported by the main thread.  */
+static void *
+async_writer (void *arg MAYBE_UNUSED)
+{
+  pthread_mutex_lock (&async_lock);
+  while (true)
+    {
+      int head;
+      int result = 0;
+
+      while (!async_queued && !async_quit)
+        pthread_cond_wait (&async_wake, &async_lock);
+      if (!async_queued)
+        break;
+      head = async_head;
+      if (!async_errno)
+        {
+          pthread_mutex_unlock (&async_lock);
+          result = write_stdout (async_ring[head], async_length[head]);
+          pthread_mutex_lock (&async_lock);
+        }
+      if (result && !async_errno)
+        async_errno = result;
+      async_head = (head + 1) % ASYNC_BUFFER_COUNT;
+      async_queued--;
+      pthread_cond_signal (&async_done);
+    }
+  pthread_mutex_unlock (&async_lock);
+  return NULL;
+}
+
+/* Queue whatever diversion 0 holds for the output thread, and switch
+   diversion 0 to the next free buffer of the ring, waiting for one to
+   become free if needed.  If DRAIN, also wait until everything queued
+   so far has been written.  Return 0, or the errno value of a failed
+   write.  */
+static int
+async_ship (bool drain)
+{
+  int result;
+
+  pthread_mutex_lock (&async_lock);
+  if (div0.used)
+    {
+      int tail = (async_head + async_queued) % ASYNC_BUFFER_COUNT;
+      async_length[tail] = div0.used;
+      async_queued++;
+      pthread_cond_signal (&async_wake);
+    }
+  while (drain ? async_queued : async_queued == ASYNC_BUFFER_COUNT)
+    pthread_cond_wait (&async_done, &async_lock);
+  result = async_errno;
+  stdout_attach (async_ring[(async_head + async_queued)
+                            % ASYNC_BUFFER_COUNT]);
+  pthread_mutex_unlock (&async_lock);
+  return result;
+}
+
+/* Start the output thread, with a ring of buffers for diversion 0.  */
+static void
+async_start (void)
+{
+  int i;
+  int result;
+
+  for (i = 0; i < ASYNC_BUFFER_COUNT; i++)
+    async_ring[i] = xcharalloc (output_buffer_size);
+  result = pthread_create (&async_thread, NULL, async_writer, NULL);
+  if (result)
+    m4_failure (result, _("cannot create output thread"));
+  async_active = true;
+}
+
+/* Stop the output thread, once it has written everything queued.  */
+static void
+async_stop (void)
+{
+  int i;
+
+  pthread_mutex_lock (&async_lock);
+  async_quit = true;
+  pthread_cond_signal (&async_wake);
+  pthread_mutex_unlock (&async_lock);
+  pthread_join (async_thread, NULL);
+  for (i = 0; i < ASYNC_BUFFER_COUNT; i++)
+    free (async_ring[i]);
+  async_active = false;
+}
+
+#endif /* ENABLE_ASYNC_OUTPUT */
+
+/* Write out whatever diversion 0 holds, and make its buffer available
+   again.  If DRAIN, do not return until the data has been written,
+   even when that is done by the output thread.  Return 0, or the
+   errno value of a failed write.  */
+static int
+stdout_ship (bool drain MAYBE_UNUSED)
+{
+  int result;
+
+  if (output_diversion == &div0)
+    div0.used = div0.size - output_unused;
+#ifdef ENABLE_ASYNC_OUTPUT
+  if (async_active)
+    return async_ship (drain);
+#endif
+  result = write_stdout (div0.u.buffer, div0.used);
+  stdout_attach (div0.u.buffer);
+  return result;
+}
+
+/* Report a failed write to standard output, with errno value ERRNUM,
+   and exit.  */
+static _Noreturn void
+stdout_failure (int errnum)
+{
+  /* Don't try again from the atexit handler.  */
+  stdout_buffered = false;
+  m4_failure (errnum, _("write error"));
+}
+
+/* Like stdout_ship, but exit on failure.  */
+static void
+stdout_handoff (bool drain)
+{
+  int result = stdout_ship (drain);
+  if (result)
+    stdout_failure (result);
+}
+
+/* Output TEXT, having LENGTH characters, to diversion 0 when it does
+   not fit in the remainder of the buffer.  Without an output thread,
+   the buffer and TEXT are written together, avoiding a copy.  */
+static void
+stdout_overflow (const char *text, int length)
+{
+  int result;
+
+#ifdef ENABLE_ASYNC_OUTPUT
+  if (async_active)
+    {
+      /* The output thread only sees the ring, so copy TEXT into it.  */
+      while (length > output_unused)
+        {
+          memcpy (output_cursor, text, (size_t) output_unused);
+          text += output_unused;
+          length -= output_unused;
+          output_cursor += output_unused;
+          output_unused = 0;
+          stdout_handoff (false);
+        }
+      memcpy (output_cursor, text, (size_t) length);
+      output_cursor += length;
+      output_unused -= length;
+      return;
+    }
+#endif
+
+  div0.used = div0.size - output_unused;
+  result = write_stdout2 (div0.u.buffer, div0.used, text, length);
+  stdout_attach (div0.u.buffer);
+  if (result)
+    stdout_failure (result);
+}
+
+/* Write any output still held for diversion 0, then return diversion
+   0 to stdio.  Return 0, or the errno value of a failed write.  */
+static int
+stdout_stop (void)
+{
+  int result = 0;
+
+  if (!stdout_buffered)
+    return 0;
+  stdout_buffered = false;
+  if (!stdout_shared)
+    result = stdout_ship (true);
+#ifdef ENABLE_ASYNC_OUTPUT
+  if (async_active)
+    async_stop ();
+#endif
+  free (stdout_buffer);
+  stdout_detach ();
+  return result;
+}
+
+/* Write any output still held for diversion 0 at exit.  Designed for
+   use as an atexit handler, where it is not safe to call exit()
+   recursively; so this calls _exit if a problem is encountered.  */
+static void
+stdout_cleanup (void)
+{
+  int result = stdout_stop ();
+  if (result)
+    {
+      M4ERROR ((0, result, _("write error")));
+      _exit (exit_failure);
+    }
+}
+
+/* Return the buffer that diversion 0 should use next, when nothing
+   is waiting to be written.  */
+static char *
+stdout_idle_buffer (void)
+{
+#ifdef ENABLE_ASYNC_OUTPUT
+  if (async_active)
+    return async_ring[async_head];
+#endif
+  return stdout_buffer;
+}
+
+/* Start managing the buffer of diversion 0.  */
+static void
+stdout_start (void)
+{
+#ifdef ENABLE_ASYNC_OUTPUT
+  if (async_output)
+    async_start ();
+  else
+#endif
+    stdout_buffer = xcharalloc (output_buffer_size);
+  stdout_buffered = true;
+  atexit (stdout_cleanup);
+  if (!stdout_shared)
+    stdout_attach (stdout_idle_buffer ());
+}
+
 
 /*------------------------.
 | Output initialization.  |
@@ -379,6 +777,12 @@ output_init (void)
   output_diversion = &div0;
   output_file = stdout;
   obstack_init (&diversion_storage);
+  /* Terminals see output as it is produced, through stdio, unless
+     asked otherwise.  */
+  if (output_buffer_size < 0)
+    output_buffer_size = isatty (STDOUT_FILENO) ? 0 : OUTPUT_BUFFER_SIZE;
+  if (output_buffer_size > 0)
+    stdout_start ();
 }
 
 void
@@ -387,6 +791,9 @@ output_exit (void)
   /* Order is important, since we may have registered cleanup_tmpfile
      as an atexit handler, and it must not traverse stale memory.  */
   gl_oset_t table = diversion_table;
+  int result = stdout_stop ();
+  if (result)
+    m4_failure (result, _("write error"));
   if (tmp_file1_owner)
     m4_tmpremove (tmp_file1_owner);
   if (tmp_file2_owner)
@@ -396,6 +803,109 @@ output_exit (void)
   obstack_free (&diversion_storage, NULL);
 }
 
+/*--------------------------------------------------------------------.
+| Write any output of diversion 0 still held in memory, so that it    |
+| appears before anything written to standard output by other means.  |
+`--------------------------------------------------------------------*/
+
+void
+output_flush (void)
+{
+  if (stdout_buffered && !stdout_shared)
+    stdout_handoff (true);
+}
+
+/*-------------------------------------------------------------------.
+| Read every diversion spilled to a temporary file back into memory, |
+| and remove the temporary directory.  This is done before forking   |
+| workers that expand from the same state, which would otherwise     |
+| share the files, and remove them when the first of them exits.  A  |
+| worker that spills again creates a directory of its own.           |
+`-------------------------------------------------------------------*/
+
+void
+output_unspill (void)
+{
+  int divnum = current_diversion;
+  int line = output_current_line;
+  gl_oset_iterator_t iter;
+  const void *elt;
+
+  if (output_temp_dir == NULL)
+    return;
+
+  /* Leave no diversion file open while the files go away.  */
+  make_diversion (-1);
+
+  iter = gl_oset_iterator (diversion_table);
+  while (gl_oset_iterator_next (&iter, &elt))
+    {
+      m4_diversion *diversion = (m4_diversion *) elt;
+      struct stat file_stat;
+      FILE *file;
+      int length;
+      int size;
+      char *buffer;
+
+      if (diversion->size || !diversion->used)
+        continue;
+      file = m4_tmpopen (diversion->divnum, true);
+      if (fflush (file) != 0 || fstat (fileno (file), &file_stat) < 0)
+        m4_failure (errno, _("cannot stat diversion"));
+      if (file_stat.st_size < 0 || file_stat.st_size > INT_MAX)
+        m4_failure (0, _("diversion too large"));
+      length = file_stat.st_size;
+      size = length < INITIAL_BUFFER_SIZE ? INITIAL_BUFFER_SIZE : length;
+      buffer = xcharalloc ((size_t) size);
+      if (length && fread (buffer, (size_t) length, 1, file) != 1)
+        m4_failure (errno, _("cannot read temporary file for diversion"));
+      if (m4_tmpclose (file, diversion->divnum) != 0
+          || m4_tmpremove (diversion->divnum) != 0)
+        m4_failure (errno, _("cannot clean temporary file for diversion"));
+
+      diversion->u.buffer = buffer;
+      diversion->size = size;
+      diversion->used = length;
+      total_buffer_size += size;
+    }
+  gl_oset_iterator_free (&iter);
+
+  if (cleanup_temp_dir (output_temp_dir) != 0)
+    m4_failure (errno, _("cannot clean temporary file for diversion"));
+  output_temp_dir = NULL;
+  tmp_name = NULL;
+
+  make_diversion (divnum);
+  output_current_line = line;
+}
+
+/*-------------------------------------------------------------------.
+| Note whether debug output goes to stdout, as SHARED.  If so,       |
+| diversion 0 must not be held in memory, or the two streams would   |
+| get out of order.                                                  |
+`-------------------------------------------------------------------*/
+
+void
+output_share_stdout (bool shared)
+{
+  if (shared == stdout_shared)
+    return;
+  if (stdout_buffered)
+    {
+      if (shared)
+        {
+          output_flush ();
+          stdout_detach ();
+        }
+      else
+        {
+          fflush (stdout);
+          stdout_attach (stdout_idle_buffer ());
+        }
+    }
+  stdout_shared = shared;
+}
+
 /*----------------------------------------------------------------.
 | Reorganize in-memory diversion buffers so the current diversion |
 | can accomodate LENGTH more characters without further           |
@@ -412,6 +922,13 @@ make_room_for (int length)
   int wanted_size;
   m4_diversion *selected_diversion = NULL;
 
+  /* Diversion 0 never grows; instead, its full buffer is written.  */
+  if (output_diversion == &div0)
+    {
+      stdout_handoff (false);
+      return;
+    }
+
   /* Compute needed size for in-memory buffer.  Diversions in-memory
      buffers start at 0 bytes, then 512, then keep doubling until it is
      decided to flush them to disk.  */
@@ -461,6 +978,7 @@ make_room_for (int length)
          m4_tmpfile), so that the atexit handler doesn't try to close
          a garbage pointer as a file.  */
 
+      stats.diversion_spills++;
       selected_buffer = selected_diversion->u.buffer;
       total_buffer_size -= selected_diversion->size;
       selected_diversion->size = 0;
@@ -560,6 +1078,12 @@ output_text (const char *text, int length)
   if (!output_diversion || !length)
     return;
 
+  if (output_diversion == &div0 && !output_file && length > output_unused)
+    {
+      stdout_overflow (text, length);
+      return;
+    }
+
   if (!output_file && length > output_unused)
     make_room_for (length);
 
@@ -677,9 +1201,13 @@ shipout_text (struct obstack *obs, const char *text, int length, int line)
             }
         }
 
-      /* Output the token, and track embedded newlines.  */
-      for (; length-- > 0; text++)
+      /* Output the token a line at a time, and track embedded
+         newlines.  */
+      while (length > 0)
         {
+          const char *newline = (const char *) memchr (text, '\n', length);
+          int span = newline ? newline - text + 1 : length;
+
           if (start_of_output_line)
             {
               start_of_output_line = false;
@@ -689,9 +1217,11 @@ shipout_text (struct obstack *obs, const char *text, int length, int line)
                        line, current_line, output_current_line);
 #endif
             }
-          OUTPUT_CHARACTER (*text);
-          if (*text == '\n')
+          output_text (text, span);
+          if (newline)
             start_of_output_line = true;
+          text += span;
+          length -= span;
         }
     }
 }
@@ -952,12 +1482,13 @@ undivert_all (void)
   gl_oset_iterator_free (&iter);
 }
 
-/*-------------------------------------------------------------.
-| Produce all diversion information in frozen format on FILE.  |
-`-------------------------------------------------------------*/
+/*---------------------------------------------------------------.
+| Produce all diversion information in frozen format VERSION on  |
+| FILE.                                                          |
+`---------------------------------------------------------------*/
 
 void
-freeze_diversions (FILE *file)
+freeze_diversions (FILE *file, int version)
 {
   int saved_number;
   int last_inserted;
@@ -969,14 +1500,30 @@ freeze_diversions (FILE *file)
   make_diversion (0);
   output_file = file; /* kludge in the frozen file */
 
+  /* Version 2 starts with the number of diversions.  */
+  if (version > 1)
+    {
+      unsigned long int count = 0;
+      iter = gl_oset_iterator (diversion_table);
+      while (gl_oset_iterator_next (&iter, &elt))
+        {
+          m4_diversion *diversion = (m4_diversion *) elt;
+          if (diversion->size || diversion->used)
+            count++;
+        }
+      gl_oset_iterator_free (&iter);
+      freeze_put_number (file, count, 4);
+    }
+
   iter = gl_oset_iterator (diversion_table);
   while (gl_oset_iterator_next (&iter, &elt))
     {
       m4_diversion *diversion = (m4_diversion *) elt;
       if (diversion->size || diversion->used)
         {
+          unsigned long int length;
           if (diversion->size)
-            xfprintf (file, "D%d,%d\n", diversion->divnum, diversion->used);
+            length = diversion->used;
           else
             {
               struct stat file_stat;
@@ -987,12 +1534,20 @@ freeze_diversions (FILE *file)
                   || (file_stat.st_size + 0UL
                       != (unsigned long int) file_stat.st_size))
                 m4_failure (0, _("diversion too large"));
-              xfprintf (file, "D%d,%lu\n", diversion->divnum,
-                        (unsigned long int) file_stat.st_size);
+              length = file_stat.st_size;
+            }
+
+          if (version > 1)
+            {
+              freeze_put_number (file, (unsigned int) diversion->divnum, 4);
+              freeze_put_number (file, length, 8);
             }
+          else
+            xfprintf (file, "D%d,%lu\n", diversion->divnum, length);
 
           insert_diversion_helper (diversion);
-          putc ('\n', file);
+          if (version == 1)
+            putc ('\n', file);
 
           last_inserted = diversion->divnum;
         }
@@ -1001,6 +1556,8 @@ freeze_diversions (FILE *file)
 
   /* Save the active diversion number, if not already.  */
 
-  if (saved_number != last_inserted)
+  if (version > 1)
+    freeze_put_number (file, (unsigned int) saved_number, 4);
+  else if (saved_number != last_inserted)
     xfprintf (file, "D%d,0\n\n", saved_number);
 }
@@ -20,10 +20,30 @@
 */
 
 /* Handling of path search of included files via the builtins "include"
-   and "sinclude".  */
+   and "sinclude".
+
+   The contents of included files are also kept in a cache, so that a
+   file included over and over, say from a loop, is neither opened nor
+   read again.  An entry is found by the name the path search resolved
+   to, and is only used while the file still has the same device,
+   inode, size, and modification and change times.  A file modified or
+   changed in the same second as it was read could change again without
+   changing those times, so such an entry is read again until that
+   second is over.  The cache is bounded by include_cache_size bytes
+   of contents; the least recently used entries go first, but not
+   before the input reading them is done with them.
+
+   Before that, the path search itself remembers where it found each
+   name, or that it found nothing, so that a name searched again costs
+   at most one attempt instead of one per directory.  Files appearing
+   in the directories searched while m4 runs are only noticed when m4
+   itself may have created them, by running a command or making a
+   temporary file, as forget_include_paths () is then called.  */
 
 #include "m4.h"
 
+#include <time.h>
+
 struct includes
 {
   struct includes *next;        /* next directory to search */
@@ -37,6 +57,40 @@ static includes *dir_list;              /* the list of path directories */
 static includes *dir_list_end;          /* the end of same */
 static int dir_max_length;              /* length of longest directory name */
 
+struct cached_file
+{
+  struct cached_file *next;     /* next entry, less recently used */
+  char *name;                   /* file name, as found by the search */
+  char *text;                   /* contents of the file */
+  size_t len;                   /* length of text */
+  dev_t dev;                    /* identity of the file read */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+  time_t loaded;                /* when the contents were read */
+  int users;                    /* inputs reading from text */
+  bool stale;                   /* dropped from the cache while in use */
+};
+
+static cached_file *cache;      /* the entries, most recently used first */
+static size_t cache_bytes;      /* total length of their contents */
+
+/* The result of an earlier path search.  */
+struct path_memo
+{
+  struct path_memo *next;       /* next entry in the same bucket */
+  char *file;                   /* name searched for */
+  char *found;                  /* name found, or NULL */
+  int error;                    /* errno of the failed search */
+};
+
+typedef struct path_memo path_memo;
+
+static path_memo **memo_table;  /* hash table of earlier searches */
+static size_t memo_buckets;     /* size of memo_table, a power of 2 */
+static size_t memo_count;       /* number of entries */
+
 
 void
 include_init (void)
@@ -99,6 +153,7 @@ add_include_directory (const char *dir)
   else
     dir_list_end->next = incl;
   dir_list_end = incl;
+  forget_include_paths ();
 
 #ifdef DEBUG_INCL
   xfprintf (stderr, "add_include_directory (%s);\n", dir);
@@ -125,42 +180,212 @@ m4_fopen (const char *file)
   return fp;
 }
 
-/* Search for FILE, first in `.', then according to -I options.  If
-   successful, return the open file, and if RESULT is not NULL, set
-   *RESULT to a malloc'd string that represents the file found with
-   respect to the current working directory.  */
+/* The result of trying a candidate file in a path search: either the
+   cached contents of the file, or the file opened.  */
+struct path_probe
+{
+  bool use_cache;               /* look for contents in the cache */
+  cached_file *hit;             /* the entry found */
+  FILE *fp;                     /* or the open file */
+};
 
-FILE *
-m4_path_search (const char *file, char **result)
+typedef struct path_probe path_probe;
+
+/* Return true if the cache entry ENTRY still holds the contents of
+   the file described by ST.  */
+static bool
+cache_valid (const cached_file *entry, const struct stat *st)
+{
+  return (entry->dev == st->st_dev && entry->ino == st->st_ino
+          && entry->size == st->st_size && entry->mtime == st->st_mtime
+          && entry->ctime == st->st_ctime && st->st_mtime < entry->loaded
+          && st->st_ctime < entry->loaded);
+}
+
+/* Try the candidate NAME of a path search, filling PROBE, and return
+   true if it is found.  */
+static bool
+probe_file (const char *name, path_probe *probe)
+{
+  if (probe->use_cache)
+    {
+      cached_file **p;
+      struct stat st;
+
+      if (stat (name, &st) != 0)
+        return false;
+      for (p = &cache; *p; p = &(*p)->next)
+        if (STREQ ((*p)->name, name))
+          {
+            cached_file *entry = *p;
+            if (!cache_valid (entry, &st))
+              break;
+            /* Move the entry to the front.  */
+            *p = entry->next;
+            entry->next = cache;
+            cache = entry;
+            probe->hit = entry;
+            return true;
+          }
+    }
+  probe->fp = m4_fopen (name);
+  return probe->fp != NULL;
+}
+
+/* Return a hash value for the file name FILE.  */
+static size_t ATTRIBUTE_PURE
+memo_hash (const char *file)
+{
+  size_t val = 0;
+  char ch;
+
+  while ((ch = *file++) != '\0')
+    val = (val << 7) + (val >> (sizeof (val) * CHAR_BIT - 7)) + ch;
+  return val;
+}
+
+/* Return the address of the link to the entry remembering the search
+   for FILE, which points to NULL if there is none.  */
+static path_memo **
+memo_lookup (const char *file)
+{
+  path_memo **p;
+
+  if (memo_table == NULL)
+    {
+      memo_buckets = 64;
+      memo_table = XCALLOC (memo_buckets, path_memo *);
+    }
+  for (p = &memo_table[memo_hash (file) & (memo_buckets - 1)]; *p;
+       p = &(*p)->next)
+    if (STREQ ((*p)->file, file))
+      break;
+  return p;
+}
+
+/* Remember that the search for FILE found FOUND, or if it is NULL,
+   failed with ERROR.  */
+static void
+memo_store (const char *file, const char *found, int error)
+{
+  path_memo **p = memo_lookup (file);
+  path_memo *memo = *p;
+
+  if (memo)
+    free (memo->found);
+  else
+    {
+      if (memo_count >= memo_buckets)
+        {
+          /* Double the table, and rehash.  */
+          path_memo **old = memo_table;
+          size_t old_buckets = memo_buckets;
+          size_t i;
+
+          memo_buckets *= 2;
+          memo_table = XCALLOC (memo_buckets, path_memo *);
+          for (i = 0; i < old_buckets; i++)
+            while (old[i])
+              {
+                path_memo *m = old[i];
+                size_t h = memo_hash (m->file) & (memo_buckets - 1);
+                old[i] = m->next;
+                m->next = memo_table[h];
+                memo_table[h] = m;
+              }
+          free (old);
+          p = memo_lookup (file);
+        }
+      memo = (path_memo *) xmalloc (sizeof *memo);
+      memo->file = xstrdup (file);
+      memo->next = NULL;
+      *p = memo;
+      memo_count++;
+    }
+  memo->found = found ? xstrdup (found) : NULL;
+  memo->error = error;
+}
+
+/* Forget the results of earlier path searches, as files may have been
+   created since.  */
+void
+forget_include_paths (void)
+{
+  size_t i;
+
+  for (i = 0; i < memo_buckets; i++)
+    while (memo_table[i])
+      {
+        path_memo *memo = memo_table[i];
+        memo_table[i] = memo->next;
+        free (memo->file);
+        free (memo->found);
+        free (memo);
+      }
+  memo_count = 0;
+}
+
+/* Search for FILE, first in `.', then according to -I options, and
+   fill PROBE with what is found.  If successful, return true, and if
+   RESULT is not NULL, set *RESULT to a malloc'd string that
+   represents the file found with respect to the current working
+   directory.  */
+static bool
+path_search (const char *file, char **result, path_probe *probe)
 {
-  FILE *fp;
   includes *incl;
+  path_memo *memo;
   char *name;                   /* buffer for constructed name */
   int e;
 
   if (result)
     *result = NULL;
+  probe->hit = NULL;
+  probe->fp = NULL;
 
   /* Reject empty file.  */
   if (!*file)
     {
       errno = ENOENT;
-      return NULL;
+      return false;
+    }
+
+  /* Try where an earlier search ended, and only search again if the
+     file found then is gone.  */
+  memo = *memo_lookup (file);
+  if (memo && !memo->found)
+    {
+      errno = memo->error;
+      return false;
+    }
+  if (memo && probe_file (memo->found, probe))
+    {
+      if ((debug_level & DEBUG_TRACE_PATH) && !STREQ (file, memo->found))
+        DEBUG_MESSAGE2 ("path search for `%s' found `%s' in cache", file,
+                        memo->found);
+      if (result)
+        *result = xstrdup (memo->found);
+      return true;
     }
 
   /* Look in current working directory first.  */
-  fp = m4_fopen (file);
-  if (fp != NULL)
+  if (probe_file (file, probe))
     {
+      memo_store (file, file, 0);
       if (result)
         *result = xstrdup (file);
-      return fp;
+      return true;
     }
 
   /* If file not found, and filename absolute, fail.  */
-  if (IS_ABSOLUTE_FILE_NAME (file) || no_gnu_extensions)
-    return NULL;
   e = errno;
+  if (IS_ABSOLUTE_FILE_NAME (file) || no_gnu_extensions)
+    {
+      if (e == ENOENT)
+        memo_store (file, NULL, e);
+      errno = e;
+      return false;
+    }
 
   for (incl = dir_list; incl != NULL; incl = incl->next)
     {
@@ -170,21 +395,186 @@ m4_path_search (const char *file, char **result)
       xfprintf (stderr, "m4_path_search (%s) -- trying %s\n", file, name);
 #endif
 
-      fp = m4_fopen (name);
-      if (fp != NULL)
+      if (probe_file (name, probe))
         {
           if (debug_level & DEBUG_TRACE_PATH)
             DEBUG_MESSAGE2 ("path search for `%s' found `%s'", file, name);
+          memo_store (file, name, 0);
           if (result)
             *result = name;
           else
             free (name);
-          return fp;
+          return true;
         }
       free (name);
     }
+
+  /* Only remember that a file does not exist, not other failures.  */
+  if (e == ENOENT)
+    memo_store (file, NULL, e);
   errno = e;
-  return fp;
+  return false;
+}
+
+/* Search for FILE, first in `.', then according to -I options.  If
+   successful, return the open file, and if RESULT is not NULL, set
+   *RESULT to a malloc'd string that represents the file found with
+   respect to the current working directory.  */
+
+FILE *
+m4_path_search (const char *file, char **result)
+{
+  path_probe probe;
+
+  probe.use_cache = false;
+  path_search (file, result, &probe);
+  return probe.fp;
+}
+
+/* Free the cache entry ENTRY, which is no longer in the cache.  */
+static void
+free_cached_file (cached_file *entry)
+{
+  free (entry->name);
+  free (entry->text);
+  free (entry);
+}
+
+/* Drop the cache entry *P from the cache, freeing it unless it is
+   still in use.  */
+static void
+drop_cached_file (cached_file **p)
+{
+  cached_file *entry = *p;
+
+  *p = entry->next;
+  cache_bytes -= entry->len;
+  if (entry->users)
+    entry->stale = true;
+  else
+    free_cached_file (entry);
+}
+
+/* Read the contents of the regular file FP, described by ST, that the
+   search for NAME found, into a new cache entry, and return it; or
+   return NULL if the file changed while read.  */
+static cached_file *
+load_cached_file (FILE *fp, const char *name, const struct stat *st)
+{
+  cached_file *entry;
+  size_t len = st->st_size;
+  char *text = xcharalloc (len + 1);
+
+  if (fread (text, 1, len, fp) != len || getc (fp) != EOF)
+    {
+      free (text);
+      return NULL;
+    }
+  text[len] = '\0';
+
+  entry = (cached_file *) xmalloc (sizeof *entry);
+  entry->name = xstrdup (name);
+  entry->text = text;
+  entry->len = len;
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtime;
+  entry->ctime = st->st_ctime;
+  entry->loaded = time (NULL);
+  entry->users = 0;
+  entry->stale = false;
+  return entry;
+}
+
+/* Search for FILE like m4_path_search, for the builtin include.  If
+   the contents of the file found are in the cache, or can be put
+   there, return that cache entry, to be read with cached_file_text
+   and released with release_cached_file.  Otherwise, return NULL and
+   set *FP to the open file, or to NULL if the search failed.  */
+
+cached_file *
+include_search (const char *file, char **result, FILE **fp)
+{
+  path_probe probe;
+  cached_file *entry;
+  cached_file **p;
+  struct stat st;
+
+  probe.use_cache = include_cache_size > 0;
+  *fp = NULL;
+  if (!path_search (file, result, &probe))
+    return NULL;
+
+  entry = probe.hit;
+  if (entry)
+    {
+      if (debug_level & DEBUG_TRACE_PATH)
+        DEBUG_MESSAGE1 ("include of `%s' found in cache", entry->name);
+      stats.include_cache_hits++;
+      entry->users++;
+      return entry;
+    }
+
+  /* Cache what is small enough, and a regular file.  */
+  if (!probe.use_cache || fstat (fileno (probe.fp), &st) != 0
+      || !S_ISREG (st.st_mode) || st.st_size > include_cache_size)
+    {
+      *fp = probe.fp;
+      return NULL;
+    }
+  entry = load_cached_file (probe.fp, *result, &st);
+  if (entry == NULL)
+    {
+      rewind (probe.fp);
+      *fp = probe.fp;
+      return NULL;
+    }
+  fclose (probe.fp);
+
+  /* Replace any older contents of the file, and make room.  */
+  for (p = &cache; *p; p = &(*p)->next)
+    if (STREQ ((*p)->name, entry->name))
+      {
+        drop_cached_file (p);
+        break;
+      }
+  entry->next = cache;
+  cache = entry;
+  cache_bytes += entry->len;
+  if (cache_bytes > (size_t) include_cache_size)
+    {
+      size_t kept = 0;
+
+      /* Keep the most recently used entries that fit.  */
+      for (p = &cache; *p; )
+        if (*p != entry && kept + (*p)->len > (size_t) include_cache_size)
+          drop_cached_file (p);
+        else
+          {
+            kept += (*p)->len;
+            p = &(*p)->next;
+          }
+    }
+  entry->users++;
+  return entry;
+}
+
+/* Return the contents of the cache entry ENTRY, and set *LEN to their
+   length.  */
+const char *
+cached_file_text (const cached_file *entry, size_t *len)
+{
+  *len = entry->len;
+  return entry->text;
+}
+
+/* Release an input reading from the cache entry ENTRY.  */
+void
+release_cached_file (cached_file *entry)
+{
+  if (--entry->users == 0 && entry->stale)
+    free_cached_file (entry);
 }
 
 #ifdef DEBUG_INCL
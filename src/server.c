@@ -0,0 +1,656 @@
+/* GNU m4 -- A simple macro processor
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* This module runs m4 as a server (--server), which sets up its state
+   once and then expands each request in a forked copy of itself, and
+   as the client that sends it requests (--connect).  It also runs the
+   batches of --batch, where each input file is expanded in a forked
+   copy of the same state, into an output file of its own, or into a
+   temporary file that is copied to the standard output in order once
+   the files before it are done (--collect).
+
+   A request is sent over a Unix domain socket.  It starts with the
+   standard input, output and error of the client, passed as file
+   descriptors along with the first bytes, and goes on with a sequence
+   of NUL terminated strings: the working directory of the client, one
+   string per command line argument to apply, and an empty string.
+   Each argument is an option letter, `D', `U', `s' or `t', followed by
+   its value, or `f' followed by the name of an input file.  The
+   server replies with the exit status of the expansion, in decimal,
+   and closes the connection.  */
+
+#include "m4.h"
+
+#if HAVE_FORK
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/wait.h>
+
+/*-------------------------------------------------------------------.
+| Return the exit status of a worker from STATUS, as set by waitpid. |
+| A worker killed by a signal gets the status of a shell, 128 plus   |
+| the number of the signal.                                          |
+`-------------------------------------------------------------------*/
+
+static int
+worker_status (int status)
+{
+  return WIFEXITED (status) ? WEXITSTATUS (status) : 128 + WTERMSIG (status);
+}
+
+/*------------------------------------------------------------------.
+| Write the LEN bytes at BUF on FD, retrying after interruptions    |
+| and partial writes.  Return false on error, with errno set.       |
+`------------------------------------------------------------------*/
+
+static bool
+write_all (int fd, const char *buf, size_t len)
+{
+  while (len)
+    {
+      ssize_t n = write (fd, buf, len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+#endif /* HAVE_FORK */
+
+#if HAVE_FORK && HAVE_SYS_UN_H
+# include <sys/socket.h>
+# include <sys/un.h>
+
+/* The standard streams, in the order they are passed.  */
+#define REQUEST_FDS 3
+
+/*-----------------------------------------------------------------.
+| Fill ADDR with the address of the socket NAME, and return its    |
+| length; or fail if NAME is too long to fit.                      |
+`-----------------------------------------------------------------*/
+
+static socklen_t
+socket_address (struct sockaddr_un *addr, const char *name)
+{
+  size_t len = strlen (name);
+
+  if (len >= sizeof addr->sun_path)
+    m4_failure (0, _("socket name too long: `%s'"), name);
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  memcpy (addr->sun_path, name, len + 1);
+  return offsetof (struct sockaddr_un, sun_path) + len + 1;
+}
+
+/*-------------------------------------------------------------------.
+| Read everything up to the end of file on FD, appending it to OBS.  |
+| Return false on error, with errno set.                             |
+`-------------------------------------------------------------------*/
+
+static bool
+read_all (int fd, struct obstack *obs)
+{
+  char buf[BUFSIZ];
+
+  while (1)
+    {
+      ssize_t n = read (fd, buf, sizeof buf);
+      if (n == 0)
+        return true;
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+      obstack_grow (obs, buf, n);
+    }
+}
+
+/*-------------------------------------------------------------------.
+| Send ARGC arguments ARGV, encoded as described at the top of this  |
+| file, as a request to the server listening on the socket NAME, and |
+| return the exit status it replies with.                            |
+`-------------------------------------------------------------------*/
+
+int
+server_request (const char *name, int argc, char *const *argv)
+{
+  struct sockaddr_un addr;
+  socklen_t addr_len = socket_address (&addr, name);
+  struct obstack request;
+  struct msghdr msg;
+  struct iovec iov;
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (REQUEST_FDS * sizeof (int))];
+  } control;
+  struct cmsghdr *cmsg;
+  int fds[REQUEST_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char *cwd;
+  size_t size;
+  size_t len;
+  ssize_t sent;
+  char *reply;
+  int fd;
+  int i;
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *) &addr, addr_len) != 0)
+    m4_failure (errno, _("cannot connect to server `%s'"), name);
+  /* A server that refuses the request closes the connection early,
+     which must be reported rather than kill the client.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  for (size = 256; ; size *= 2)
+    {
+      cwd = xcharalloc (size);
+      if (getcwd (cwd, size))
+        break;
+      if (errno != ERANGE)
+        m4_failure (errno, _("cannot get working directory"));
+      free (cwd);
+    }
+  obstack_init (&request);
+  obstack_grow0 (&request, cwd, strlen (cwd));
+  free (cwd);
+  for (i = 0; i < argc; i++)
+    obstack_grow0 (&request, argv[i], strlen (argv[i]));
+  obstack_1grow (&request, '\0');
+  len = obstack_object_size (&request);
+  cwd = (char *) obstack_finish (&request);
+
+  /* The descriptors go along with the first bytes.  */
+  memset (&msg, 0, sizeof msg);
+  iov.iov_base = cwd;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof fds);
+  memcpy (CMSG_DATA (cmsg), fds, sizeof fds);
+  do
+    sent = sendmsg (fd, &msg, 0);
+  while (sent < 0 && errno == EINTR);
+  if (sent < 0 || !write_all (fd, cwd + sent, len - sent)
+      || shutdown (fd, SHUT_WR) != 0)
+    m4_failure (errno, _("cannot send request to server `%s'"), name);
+  obstack_free (&request, cwd);
+
+  if (!read_all (fd, &request))
+    m4_failure (errno, _("cannot read reply from server `%s'"), name);
+  obstack_1grow (&request, '\0');
+  reply = (char *) obstack_finish (&request);
+  close (fd);
+  if (!c_isdigit (*reply))
+    m4_failure (0, _("no reply from server `%s'"), name);
+  i = strtol (reply, NULL, 10);
+  obstack_free (&request, NULL);
+  return i;
+}
+
+/*-----------------------------------------------------------------.
+| Return true if the client on the connection CONN runs as the     |
+| same user as the server.  Where this cannot be checked, only the |
+| mode of the socket keeps other users out.                        |
+`-----------------------------------------------------------------*/
+
+static bool
+peer_is_owner (int conn MAYBE_UNUSED)
+{
+#if HAVE_GETPEEREID
+  uid_t uid;
+  gid_t gid;
+
+  return getpeereid (conn, &uid, &gid) == 0 && uid == geteuid ();
+#elif defined SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+
+  return (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+          && cred.uid == geteuid ());
+#else
+  return true;
+#endif
+}
+
+/*-------------------------------------------------------------------.
+| Handle the request on the connection CONN, in a process of its own |
+| that only waits for a second one, the worker, to run JOB, and then |
+| replies with the exit status of the worker.  The descriptors of    |
+| the client become the standard streams of the worker.              |
+`-------------------------------------------------------------------*/
+
+static _Noreturn void
+handle_request (int conn, forked_job *job)
+{
+  struct obstack request;
+  struct msghdr msg;
+  struct iovec iov;
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (REQUEST_FDS * sizeof (int))];
+  } control;
+  struct cmsghdr *cmsg;
+  int fds[REQUEST_FDS];
+  char buf[BUFSIZ];
+  char reply[INT_BUFSIZE_BOUND (int) + 1];
+  ssize_t n;
+  char *data;
+  char *end;
+  char *nul;
+  char *p;
+  char **argv;
+  int argc;
+  pid_t pid;
+  int status;
+  int i;
+
+  memset (&msg, 0, sizeof msg);
+  iov.iov_base = buf;
+  iov.iov_len = sizeof buf;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  do
+    n = recvmsg (conn, &msg, 0);
+  while (n < 0 && errno == EINTR);
+  cmsg = n > 0 ? CMSG_FIRSTHDR (&msg) : NULL;
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof fds))
+    {
+      M4ERROR ((warning_status, 0, _("malformed request ignored")));
+      _exit (EXIT_FAILURE);
+    }
+  memcpy (fds, CMSG_DATA (cmsg), sizeof fds);
+
+  obstack_init (&request);
+  obstack_grow (&request, buf, n);
+  if (!read_all (conn, &request))
+    {
+      M4ERROR ((warning_status, errno, _("cannot read request")));
+      _exit (EXIT_FAILURE);
+    }
+  n = obstack_object_size (&request);
+  data = (char *) obstack_finish (&request);
+  end = data + n;
+
+  /* Split the strings, which must end with an empty one.  Nothing
+     guarantees that the last one is terminated, so each end is only
+     searched for up to the end of the request.  */
+  for (argc = 0, p = data; p < end && *p; argc++)
+    {
+      nul = (char *) memchr (p, '\0', end - p);
+      if (nul == NULL)
+        break;
+      p = nul + 1;
+    }
+  if (p >= end || *p || argc == 0)
+    {
+      M4ERROR ((warning_status, 0, _("malformed request ignored")));
+      _exit (EXIT_FAILURE);
+    }
+  argv = (char **) obstack_alloc (&request, argc * sizeof *argv);
+  for (i = 0, p = data; i < argc; i++)
+    {
+      argv[i] = p;
+      p = (char *) memchr (p, '\0', end - p) + 1;
+    }
+
+  signal (SIGCHLD, SIG_DFL);
+  pid = fork ();
+  if (pid == 0)
+    {
+      close (conn);
+      for (i = 0; i < REQUEST_FDS; i++)
+        if (fds[i] != i)
+          {
+            dup2 (fds[i], i);
+            close (fds[i]);
+          }
+      if (chdir (argv[0]) != 0)
+        m4_failure (errno, _("cannot change to directory `%s'"), argv[0]);
+      forget_include_paths ();
+      debug_forked ();
+      job (argc - 1, argv + 1);
+      exit (retcode);
+    }
+  for (i = 0; i < REQUEST_FDS; i++)
+    close (fds[i]);
+
+  if (pid < 0)
+    {
+      M4ERROR ((warning_status, errno, _("cannot fork")));
+      status = EXIT_FAILURE;
+    }
+  else
+    {
+      while (waitpid (pid, &status, 0) < 0)
+        if (errno != EINTR)
+          _exit (EXIT_FAILURE);
+      status = worker_status (status);
+    }
+  sprintf (reply, "%d\n", status);
+  write_all (conn, reply, strlen (reply));
+  _exit (EXIT_SUCCESS);
+}
+
+/*-------------------------------------------------------------------.
+| Listen on the Unix domain socket NAME, replacing any socket of     |
+| that name, and run JOB in a forked copy of the current state for   |
+| each request received, with the arguments of the request.  Since   |
+| a request can run commands as the user of the server, the socket   |
+| is only accessible to that user, and other users are refused.      |
+| This never returns; the server runs until it is killed.            |
+`-------------------------------------------------------------------*/
+
+_Noreturn void
+serve (const char *name, forked_job *job)
+{
+  struct sockaddr_un addr;
+  socklen_t addr_len = socket_address (&addr, name);
+  struct stat st;
+  mode_t mask;
+  int sock;
+  int bound;
+
+  if (lstat (name, &st) == 0 && S_ISSOCK (st.st_mode))
+    unlink (name);
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    m4_failure (errno, _("cannot listen on `%s'"), name);
+  mask = umask (S_IRWXG | S_IRWXO);
+  bound = bind (sock, (struct sockaddr *) &addr, addr_len);
+  umask (mask);
+  if (bound != 0 || listen (sock, SOMAXCONN) != 0)
+    m4_failure (errno, _("cannot listen on `%s'"), name);
+
+  /* Nothing buffered may be written again by every request, and no
+     request may remove files the others still need.  */
+  output_flush ();
+  trace_json_flush ();
+  output_unspill ();
+  fflush (NULL);
+
+  /* The processes handling requests are never waited for.  */
+  signal (SIGCHLD, SIG_IGN);
+  while (1)
+    {
+      pid_t pid;
+      int conn = accept (sock, NULL, NULL);
+
+      if (conn < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          m4_failure (errno, _("cannot accept connection on `%s'"), name);
+        }
+      if (!peer_is_owner (conn))
+        {
+          M4ERROR ((warning_status, 0,
+                    _("request from another user refused")));
+          close (conn);
+          continue;
+        }
+      pid = fork ();
+      if (pid == 0)
+        {
+          close (sock);
+          handle_request (conn, job);
+        }
+      if (pid < 0)
+        M4ERROR ((warning_status, errno, _("cannot fork")));
+      close (conn);
+    }
+}
+
+#endif /* HAVE_FORK && HAVE_SYS_UN_H */
+
+#if HAVE_FORK
+
+/*-----------------------------------------------------------------.
+| Return the name of the output file for the batch input FILE: the |
+| same name without its `.m4' suffix, or with `.out' appended when |
+| it has none.  The standard input goes to the standard output, so |
+| return NULL for `-'.                                             |
+`-----------------------------------------------------------------*/
+
+static char *
+batch_output_name (const char *file)
+{
+  size_t len = strlen (file);
+
+  if (STREQ (file, "-"))
+    return NULL;
+  if (len > 3 && STREQ (file + len - 3, ".m4") && file[len - 4] != '/')
+    {
+      char *name = xcharalloc (len - 2);
+      memcpy (name, file, len - 3);
+      name[len - 3] = '\0';
+      return name;
+    }
+  return xasprintf ("%s.out", file);
+}
+
+/*-----------------------------------------------------------------.
+| Run JOB on the batch input FILE, in a worker forked for it, with |
+| the standard output redirected to FD, or if it is -1, to the     |
+| output file of FILE.                                             |
+`-----------------------------------------------------------------*/
+
+static _Noreturn void
+run_batch_job (const char *file, int fd, forked_job *job)
+{
+  char *arg = xasprintf ("f%s", file);
+
+  if (fd < 0)
+    {
+      char *output = batch_output_name (file);
+      if (output)
+        {
+          fd = open (output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+          if (fd < 0)
+            m4_failure (errno, _("cannot open `%s'"), output);
+          free (output);
+        }
+    }
+  if (fd >= 0 && fd != STDOUT_FILENO)
+    {
+      dup2 (fd, STDOUT_FILENO);
+      close (fd);
+    }
+  debug_forked ();
+  job (1, &arg);
+  exit (retcode);
+}
+
+/*----------------------------------------------------------------.
+| Copy the output a worker left in the temporary file TMP to the  |
+| standard output, and close TMP.                                 |
+`----------------------------------------------------------------*/
+
+static void
+copy_batch_output (FILE *tmp)
+{
+  char buf[BUFSIZ];
+  int fd = fileno (tmp);
+  ssize_t n;
+
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    m4_failure (errno, _("cannot read batch output"));
+  while ((n = read (fd, buf, sizeof buf)) != 0)
+    {
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          m4_failure (errno, _("cannot read batch output"));
+        }
+      if (!write_all (STDOUT_FILENO, buf, n))
+        m4_failure (errno, _("write error"));
+    }
+  fclose (tmp);
+}
+
+/*------------------------------------------------------------------.
+| Run JOB once for each of the COUNT input FILES, each in a copy of |
+| the current state forked for it, with up to JOBS of them at once. |
+| If COLLECT, the outputs go to the standard output, in the order   |
+| of FILES whatever the order the workers finish in.  Return the    |
+| exit status of the first file, in the order given, that failed,   |
+| or EXIT_SUCCESS if none did.                                      |
+`------------------------------------------------------------------*/
+
+int
+run_batch (int count, char *const *files, int jobs, bool collect,
+           forked_job *job)
+{
+  pid_t *pids = XNMALLOC (count, pid_t);
+  FILE **outputs = collect ? XCALLOC (count, FILE *) : NULL;
+  bool *done = XCALLOC (count, bool);
+  int failed = count;           /* index of the first failed file */
+  int result = EXIT_SUCCESS;
+  int running = 0;
+  int next = 0;                 /* index of the next file to start */
+  int copied = 0;               /* index of the next output to copy */
+  int i;
+
+  /* Nothing buffered may be written again by every worker, and no
+     worker may remove files the others still need.  */
+  output_flush ();
+  trace_json_flush ();
+  output_unspill ();
+  fflush (NULL);
+
+  if (jobs < 1)
+    jobs = 1;
+  while (next < count || running)
+    {
+      pid_t pid;
+      int status;
+      int fd = -1;
+
+      /* Workers are not started too far ahead of a slow one whose
+         output must be copied first, so as to bound the number of
+         temporary files.  */
+      if (next < count && running < jobs
+          && (!collect || next - copied < 4 * jobs))
+        {
+          if (collect)
+            {
+              outputs[next] = tmpfile ();
+              if (outputs[next] == NULL)
+                m4_failure (errno, _("cannot create temporary file"));
+              fd = fileno (outputs[next]);
+            }
+          pid = fork ();
+          if (pid == 0)
+            run_batch_job (files[next], fd, job);
+          if (pid < 0)
+            {
+              M4ERROR ((warning_status, errno, _("cannot fork")));
+              done[next] = true;
+              if (next < failed)
+                {
+                  failed = next;
+                  result = EXIT_FAILURE;
+                }
+            }
+          else
+            running++;
+          pids[next++] = pid;
+        }
+      else
+        {
+          pid = waitpid (-1, &status, 0);
+          if (pid < 0)
+            {
+              if (errno == EINTR)
+                continue;
+              m4_failure (errno, _("cannot wait for batch jobs"));
+            }
+          for (i = 0; i < next; i++)
+            if (pids[i] == pid)
+              break;
+          if (i == next)
+            continue;
+          running--;
+          done[i] = true;
+          status = worker_status (status);
+          if (status != EXIT_SUCCESS && i < failed)
+            {
+              failed = i;
+              result = status;
+            }
+        }
+
+      if (collect)
+        for (; copied < next && done[copied]; copied++)
+          copy_batch_output (outputs[copied]);
+    }
+  free (outputs);
+  free (done);
+  free (pids);
+  return result;
+}
+
+#endif /* HAVE_FORK */
+
+#if !(HAVE_FORK && HAVE_SYS_UN_H)
+
+int
+server_request (const char *name, int argc MAYBE_UNUSED,
+                char *const *argv MAYBE_UNUSED)
+{
+  m4_failure (0, _("cannot connect to server `%s': not supported"), name);
+}
+
+_Noreturn void
+serve (const char *name, forked_job *job MAYBE_UNUSED)
+{
+  m4_failure (0, _("cannot listen on `%s': not supported"), name);
+}
+
+#endif /* !(HAVE_FORK && HAVE_SYS_UN_H) */
+
+#if !HAVE_FORK
+
+int
+run_batch (int count MAYBE_UNUSED, char *const *files MAYBE_UNUSED,
+           int jobs MAYBE_UNUSED, bool collect MAYBE_UNUSED,
+           forked_job *job MAYBE_UNUSED)
+{
+  m4_failure (0, _("batch mode not supported"));
+}
+
+#endif /* !HAVE_FORK */
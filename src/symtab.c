@@ -133,6 +133,17 @@ hash (const char *s)
   return val;
 }
 
+/*-----------------------------------------------------------------.
+| Return the hash value of the symbol name S, for checking the one |
+| recorded in a frozen file.                                       |
+`-----------------------------------------------------------------*/
+
+size_t
+symbol_hash (const char *s)
+{
+  return hash (s);
+}
+
 /*--------------------------------------------.
 | Free all storage associated with a symbol.  |
 `--------------------------------------------*/
@@ -146,8 +157,9 @@ free_symbol (symbol *sym)
     {
       if (SYMBOL_STACK (sym) == NULL)
         free (SYMBOL_NAME (sym));
-      if (SYMBOL_TYPE (sym) == TOKEN_TEXT)
+      if (SYMBOL_TYPE (sym) == TOKEN_TEXT && !SYMBOL_MAPPED (sym))
         free (SYMBOL_TEXT (sym));
+      free (SYMBOL_DISPATCH (sym));
       free (sym);
     }
 }
@@ -225,6 +237,9 @@ lookup_symbol (const char *name, symbol_lookup mode)
               SYMBOL_MACRO_ARGS (sym) = false;
               SYMBOL_BLIND_NO_ARGS (sym) = false;
               SYMBOL_DELETED (sym) = false;
+              SYMBOL_MAPPED (sym) = false;
+              SYMBOL_INERT (sym) = false;
+              SYMBOL_DISPATCH (sym) = NULL;
               SYMBOL_PENDING_EXPANSIONS (sym) = 0;
 
               SYMBOL_STACK (sym) = SYMBOL_STACK (old);
@@ -249,6 +264,9 @@ lookup_symbol (const char *name, symbol_lookup mode)
       SYMBOL_MACRO_ARGS (sym) = false;
       SYMBOL_BLIND_NO_ARGS (sym) = false;
       SYMBOL_DELETED (sym) = false;
+      SYMBOL_MAPPED (sym) = false;
+      SYMBOL_INERT (sym) = false;
+      SYMBOL_DISPATCH (sym) = NULL;
       SYMBOL_PENDING_EXPANSIONS (sym) = 0;
 
       SYMBOL_STACK (sym) = NULL;
@@ -313,6 +331,9 @@ lookup_symbol (const char *name, symbol_lookup mode)
             SYMBOL_MACRO_ARGS (sym) = false;
             SYMBOL_BLIND_NO_ARGS (sym) = false;
             SYMBOL_DELETED (sym) = false;
+            SYMBOL_MAPPED (sym) = false;
+            SYMBOL_INERT (sym) = false;
+            SYMBOL_DISPATCH (sym) = NULL;
             SYMBOL_PENDING_EXPANSIONS (sym) = 0;
 
             SYMBOL_STACK (sym) = NULL;
@@ -330,6 +351,47 @@ lookup_symbol (const char *name, symbol_lookup mode)
     }
 }
 
+/*--------------------------------------------------------------------.
+| Return a new symbol, taking ownership of NAME, whose hash value is  |
+| H.  It has no definition, and is linked to nothing.  This is only   |
+| used to build whole bucket chains for install_symbol_chain ().      |
+`--------------------------------------------------------------------*/
+
+symbol *
+new_symbol (char *name, size_t h)
+{
+  symbol *sym = (symbol *) xmalloc (sizeof (symbol));
+  SYMBOL_TYPE (sym) = TOKEN_VOID;
+  SYMBOL_TRACED (sym) = false;
+  sym->hash = h;
+  SYMBOL_NAME (sym) = name;
+  SYMBOL_MACRO_ARGS (sym) = false;
+  SYMBOL_BLIND_NO_ARGS (sym) = false;
+  SYMBOL_DELETED (sym) = false;
+  SYMBOL_MAPPED (sym) = false;
+  SYMBOL_INERT (sym) = false;
+  SYMBOL_DISPATCH (sym) = NULL;
+  SYMBOL_PENDING_EXPANSIONS (sym) = 0;
+
+  SYMBOL_STACK (sym) = NULL;
+  sym->next = NULL;
+  return sym;
+}
+
+/*--------------------------------------------------------------------.
+| Install CHAIN as the contents of the empty hash bucket BUCKET.  The |
+| symbols must be linked and ordered exactly as lookup_symbol ()      |
+| would have left them, which is the case when reloading an indexed   |
+| frozen file produced with the same hash table size.                 |
+`--------------------------------------------------------------------*/
+
+void
+install_symbol_chain (size_t bucket, symbol *chain)
+{
+  assert (bucket < hash_table_size && symtab[bucket] == NULL);
+  symtab[bucket] = chain;
+}
+
 /*-----------------------------------------------------------------.
 | The following function is used for the cases where we want to do |
 | something to each and every symbol in the table.  The function   |
@@ -361,6 +423,33 @@ hack_all_symbols (hack_symbol *func, void *data)
     }
 }
 
+/*------------------------------------------------------------------.
+| Store in *SYMBOLS the number of names in the symbol table, in     |
+| *USED the number of hash buckets holding at least one, and in     |
+| *LONGEST the length of the longest bucket chain.                  |
+`------------------------------------------------------------------*/
+
+void
+symtab_load (size_t *symbols, size_t *used, size_t *longest)
+{
+  size_t h;
+  size_t length;
+  symbol *sym;
+
+  *symbols = *used = *longest = 0;
+  for (h = 0; h < hash_table_size; h++)
+    {
+      length = 0;
+      for (sym = symtab[h]; sym != NULL; sym = sym->next)
+        length++;
+      *symbols += length;
+      if (length > 0)
+        (*used)++;
+      if (length > *longest)
+        *longest = length;
+    }
+}
+
 #ifdef DEBUG_SYM
 
 static void symtab_print_list (int i);